@@ -0,0 +1,255 @@
+///////////////////////////////////////////////////////////////////////////////
+// asyncsolve.hh
+//
+// C++20 coroutine interface to the solvers: loads and solves run on the
+// thread pool, and the coroutine awaiting them is resumed on the worker
+// that finished, so no thread sits blocked per request.
+//
+// How to use:
+//
+//  Task<double> handle(const FoodVector & foods, CancellationToken token) {
+//    auto solution = co_await async_dynamic_max_weight(foods, 2000, token);
+//    if (!solution) {
+//      co_return 0;  // cancelled
+//    }
+//    double calories, weight;
+//    sum_food_vector(*solution, calories, weight);
+//    co_return weight;
+//  }
+//
+//  // outside of any coroutine
+//  double weight = handle(foods, token).get();
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "maxweight.hh"
+#include "threadpool.hh"
+
+// Shared flag for cancelling operations. Copies share the flag, so passing
+// a request's token down to every operation it starts cancels all of them
+// at once.
+class CancellationToken {
+public:
+  CancellationToken()
+  : _flag(std::make_shared<std::atomic<bool>>(false)) { }
+
+  void cancel() const {
+    _flag->store(true);
+  }
+
+  bool cancelled() const {
+    return _flag->load();
+  }
+
+  // For the solvers that take a cancellation flag.
+  const std::atomic<bool> * flag() const {
+    return _flag.get();
+  }
+
+private:
+  std::shared_ptr<std::atomic<bool>> _flag;
+};
+
+// Coroutine returning a T. It starts running as soon as it is called, and
+// can be awaited by one other coroutine, or waited for with get().
+// The Task must be awaited or waited for before it is destroyed; the
+// destructor waits if it is still running.
+template <typename T>
+class Task {
+public:
+  struct promise_type {
+    std::optional<T> value;
+    std::exception_ptr error;
+    // nullptr while running with no awaiter, then the awaiting coroutine,
+    // or &finished once done.
+    std::atomic<void *> continuation{nullptr};
+
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_never initial_suspend() noexcept {
+      return {};
+    }
+
+    auto final_suspend() noexcept {
+      struct Resume {
+        bool await_ready() noexcept {
+          return false;
+        }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> self) noexcept {
+          void * awaiter = self.promise().continuation.exchange(&finished, std::memory_order_acq_rel);
+          return awaiter ? std::coroutine_handle<>::from_address(awaiter) : std::noop_coroutine();
+        }
+        void await_resume() noexcept { }
+      };
+      return Resume{};
+    }
+
+    void return_value(T result) {
+      value.emplace(std::move(result));
+    }
+
+    void unhandled_exception() {
+      error = std::current_exception();
+    }
+  };
+
+  Task(Task && other) noexcept
+  : _handle(std::exchange(other._handle, nullptr)) { }
+
+  Task(const Task &) = delete;
+  Task & operator=(const Task &) = delete;
+
+  ~Task() {
+    if (_handle) {
+      wait();
+      _handle.destroy();
+    }
+  }
+
+  bool done() const {
+    return _handle.promise().continuation.load(std::memory_order_acquire) == &finished;
+  }
+
+  // co_await support: the result, or the exception the coroutine threw.
+  bool await_ready() const noexcept {
+    return done();
+  }
+
+  bool await_suspend(std::coroutine_handle<> awaiter) noexcept {
+    void * expected = nullptr;
+    // Fails only if the task finished in the meantime; then don't suspend.
+    return _handle.promise().continuation.compare_exchange_strong(expected, awaiter.address(), std::memory_order_acq_rel);
+  }
+
+  T await_resume() {
+    if (_handle.promise().error) {
+      std::rethrow_exception(_handle.promise().error);
+    }
+    return std::move(*_handle.promise().value);
+  }
+
+  // Block the calling thread until the task is done, and return its result.
+  // Don't call this from a pool worker the task needs.
+  T get() {
+    wait();
+    return await_resume();
+  }
+
+private:
+  explicit Task(std::coroutine_handle<promise_type> handle)
+  : _handle(handle) { }
+
+  // Fire-and-forget coroutine for wait().
+  struct Detached {
+    struct promise_type {
+      Detached get_return_object() { return {}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() { }
+      void unhandled_exception() { std::terminate(); }
+    };
+  };
+
+  // Awaits the task without taking its result.
+  struct Completion {
+    Task & task;
+    bool await_ready() { return task.await_ready(); }
+    bool await_suspend(std::coroutine_handle<> awaiter) { return task.await_suspend(awaiter); }
+    void await_resume() { }
+  };
+
+  static Detached signal_when_done(Task & task, std::promise<void> finished) {
+    co_await Completion{task};
+    finished.set_value();
+  }
+
+  void wait() {
+    if (done()) {
+      return;
+    }
+    std::promise<void> finished;
+    auto future = finished.get_future();
+    signal_when_done(*this, std::move(finished));
+    future.wait();
+  }
+
+  static inline char finished;
+  std::coroutine_handle<promise_type> _handle;
+};
+
+// co_await resume_on(pool) moves the rest of the coroutine onto a worker of
+// pool.
+inline auto resume_on(ThreadPool & pool) {
+  struct Schedule {
+    ThreadPool & pool;
+    bool await_ready() noexcept {
+      return false;
+    }
+    void await_suspend(std::coroutine_handle<> self) {
+      pool.submit([self]() { self.resume(); });
+    }
+    void await_resume() noexcept { }
+  };
+  return Schedule{pool};
+}
+
+// Load the food database on pool. Returns nullptr on the same errors as
+// load_food_database, or if token was cancelled before the load started.
+Task<std::unique_ptr<FoodVector>> async_load_food_database(
+  std::string path,
+    CancellationToken token = CancellationToken(),
+    ThreadPool & pool = default_thread_pool()
+) {
+  if (token.cancelled()) {
+    co_return nullptr;
+  }
+  co_await resume_on(pool);
+  if (token.cancelled()) {
+    co_return nullptr;
+  }
+  co_return load_food_database(path);
+}
+
+// Compute the same optimal set of food items as dynamic_max_weight, on
+// pool. foodItems must stay alive until the task is done. Returns nullptr
+// if token is cancelled first; a solve in progress notices within one row
+// of the table.
+Task<std::unique_ptr<FoodVector>> async_dynamic_max_weight(
+  const FoodVector & foodItems,
+    double totalCalorieLimit,
+    CancellationToken token = CancellationToken(),
+    ThreadPool & pool = default_thread_pool()
+) {
+  if (token.cancelled()) {
+    co_return nullptr;
+  }
+  co_await resume_on(pool);
+
+  DynamicScratch scratch;
+  std::vector<size_t> selection = dynamic_max_weight_indices(foodItems, totalCalorieLimit, scratch, token.flag());
+  if (token.cancelled()) {
+    co_return nullptr;
+  }
+  std::unique_ptr<FoodVector> optimalFoodSelection(new FoodVector);
+  for (size_t index: selection) {
+    optimalFoodSelection->push_back(foodItems[index]);
+  }
+  co_return optimalFoodSelection;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// asyncsolve.hh
+///////////////////////////////////////////////////////////////////////////////
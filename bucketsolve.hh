@@ -0,0 +1,132 @@
+///////////////////////////////////////////////////////////////////////////////
+// bucketsolve.hh
+//
+// Dynamic programming over buckets of items with equal calories, instead
+// of one item at a time.
+//
+// Within a bucket of m items of c calories, taking k of them is best done
+// with the k heaviest, so the bucket is sorted by weight and its profile
+// P[k] (the k heaviest weights summed) is concave. Applying the bucket to a
+// DP row is, for each residue r modulo c, a (max, +) convolution of the
+// row's columns r, r + c, r + 2c, ... with P:
+//
+//   next[r + j c] = max over k of row[r + (j - k) c] + P[k]
+//
+// P being concave, the best k moves monotonically with j, so the columns
+// of a residue class are solved by divide and conquer on j, each step
+// searching only between its neighbours' answers: O(C log C) for the
+// bucket, where dynamic_max_weight spends O(m C) on its items one by one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "maxweight.hh"
+
+// Compute an optimal set of food items, of the same total weight as
+// dynamic_max_weight's, applying the items with equal calories (rounded up,
+// as the table counts them) as one bucket. Ties between equally good
+// selections may be broken differently. The chosen items are returned last
+// item first.
+std::unique_ptr<FoodVector> bucketed_dynamic_max_weight(
+  const FoodVector & foodItems,
+    double totalCalorieLimit
+) {
+  std::unique_ptr<FoodVector> optimalFoodSelection(new FoodVector);
+  if (totalCalorieLimit < 0) {
+    return optimalFoodSelection;
+  }
+
+  std::size_t columns = static_cast<std::size_t>(largest_reachable_calorie_total(foodItems, totalCalorieLimit)) + 1;
+
+  // Items with the same calories, heaviest first.
+  struct Bucket {
+    std::size_t calories;
+    std::vector<size_t> items;
+    // How many of the items the best selection for each column takes.
+    std::vector<uint32_t> taken;
+  };
+  std::map<std::size_t, Bucket> byCalories;
+  // Only items that can do better than being left out: positive weight,
+  // and calories within the table.
+  for (size_t index = 0; index < foodItems.size(); index++) {
+    double calories = std::ceil(foodItems[index]->calorie());
+    if (foodItems[index]->weight() > 0 && calories < columns) {
+      Bucket & bucket = byCalories[static_cast<std::size_t>(calories)];
+      bucket.calories = static_cast<std::size_t>(calories);
+      bucket.items.push_back(index);
+    }
+  }
+
+  std::vector<double> row(columns, 0), next(columns), profile;
+  for (auto & entry: byCalories) {
+    Bucket & bucket = entry.second;
+    std::stable_sort(bucket.items.begin(), bucket.items.end(), [&](size_t a, size_t b) {
+      return foodItems[a]->weight() > foodItems[b]->weight();
+    });
+    std::size_t m = bucket.items.size(), c = bucket.calories;
+    profile.assign(1, 0);
+    for (size_t index: bucket.items) {
+      profile.push_back(profile.back() + foodItems[index]->weight());
+    }
+    bucket.taken.assign(columns, 0);
+
+    for (std::size_t residue = 0; residue < std::min(c, columns); residue++) {
+      std::size_t length = (columns - 1 - residue) / c + 1;
+      auto column = [&](size_t j) { return residue + j * c; };
+      // Solve next for j in [first, last], knowing the best i = j - k lies
+      // in [low, high].
+      auto solve = [&](auto & self, size_t first, size_t last, size_t low, size_t high) -> void {
+        if (first > last) {
+          return;
+        }
+        size_t j = first + (last - first) / 2;
+        size_t best_i = std::max(low, j >= m ? j - m : 0), end_i = std::min(high, j);
+        double best = row[column(best_i)] + profile[j - best_i];
+        for (size_t i = best_i + 1; i <= end_i; i++) {
+          double weight = row[column(i)] + profile[j - i];
+          // On ties, take fewer items, like dynamic_max_weight.
+          if (weight >= best) {
+            best = weight;
+            best_i = i;
+          }
+        }
+        next[column(j)] = best;
+        bucket.taken[column(j)] = j - best_i;
+        if (j > first) {
+          self(self, first, j - 1, low, best_i);
+        }
+        self(self, j + 1, last, best_i, high);
+      };
+      solve(solve, 0, length - 1, 0, length - 1);
+    }
+    std::swap(row, next);
+  }
+
+  // Walk the buckets back from the full budget.
+  std::vector<size_t> selection;
+  std::size_t remainingCalories = columns - 1;
+  for (auto entry = byCalories.rbegin(); entry != byCalories.rend(); ++entry) {
+    const Bucket & bucket = entry->second;
+    uint32_t taken = bucket.taken[remainingCalories];
+    selection.insert(selection.end(), bucket.items.begin(), bucket.items.begin() + taken);
+    remainingCalories -= taken * bucket.calories;
+  }
+
+  std::sort(selection.rbegin(), selection.rend());
+  for (size_t index: selection) {
+    optimalFoodSelection->push_back(foodItems[index]);
+  }
+  return optimalFoodSelection;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// bucketsolve.hh
+///////////////////////////////////////////////////////////////////////////////
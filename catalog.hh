@@ -0,0 +1,350 @@
+///////////////////////////////////////////////////////////////////////////////
+// catalog.hh
+//
+// Hold the current version of the food catalog, and reload it in the
+// background when the file changes, without blocking solves that are using
+// the previous version. Reloads can diff the file against the current
+// version and only parse the rows that changed, and report what changed so
+// that whatever is derived from the catalog can be carried over.
+//
+// How to use:
+//
+//  CatalogHolder catalog("food.csv");
+//  catalog.start_watching();
+//  ...
+//  // per request: pin the current version for the whole solve
+//  auto snapshot = catalog.current();
+//  auto solution = dynamic_max_weight(*snapshot->foods, 2000);
+//
+// Versions are published through a std::atomic<std::shared_ptr>, which acts as
+// a read-copy-update scheme: readers take a reference without locking, a
+// reload never waits for readers, and an old version is freed when the last
+// solve holding it drops its reference.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "maxweight.hh"
+
+// One immutable version of the catalog.
+struct CatalogSnapshot {
+  // Counts up from 1 with each successful load.
+  uint64_t version;
+  std::unique_ptr<FoodVector> foods;
+  // Position of each item in foods, by item ID.
+  std::unordered_map<uint32_t, uint32_t> positions;
+  // Hash of the CSV row each item was parsed from, parallel to foods.
+  std::vector<uint64_t> row_hashes;
+  // Rows that were skipped as invalid.
+  std::vector<FoodLoadError> load_errors;
+};
+
+// What changed between two versions of the catalog.
+// A row whose text is unchanged keeps its FoodItem, and so its ID. Of the
+// rest, a new row with the same description as a vanished row counts as an
+// update of it; any others are additions or removals.
+struct FoodRowDelta {
+  // Positions in the new version.
+  std::vector<size_t> added;
+  // Positions in the old version.
+  std::vector<size_t> removed;
+  // (position in the old version, position in the new version)
+  std::vector<std::pair<size_t, size_t>> updated;
+  // Rows carried over as is.
+  size_t unchanged = 0;
+  // Whether the rows carried over are in a different order than before.
+  bool reordered = false;
+};
+
+class CatalogHolder {
+public:
+  // Load path now. If that fails, current() is nullptr until a reload
+  // succeeds.
+  explicit CatalogHolder(const std::string & path)
+  : _path(path), _versions(0), _stop_fd(-1) {
+    reload();
+  }
+
+  CatalogHolder(const CatalogHolder &) = delete;
+  CatalogHolder & operator=(const CatalogHolder &) = delete;
+
+  ~CatalogHolder() {
+    stop_watching();
+  }
+
+  // The current version. Hold on to the returned pointer for the duration
+  // of a request, so that the whole request sees a single version.
+  std::shared_ptr<const CatalogSnapshot> current() const {
+    return _current.load();
+  }
+
+  // Load the file again and publish it as the new current version. Invalid
+  // rows are skipped and listed in the version's load_errors.
+  // Returns false, keeping the current version, if the file can't be read.
+  bool reload() {
+    std::lock_guard<std::mutex> lock(_reload_mutex);
+    return load(nullptr, nullptr);
+  }
+
+  // Like reload(), but diff the file against the current version by row
+  // hash: only added and updated rows are parsed into new items, and
+  // unchanged rows share their items with the current version, so the
+  // solver caches keep recognizing them. When delta is given it receives
+  // the changes.
+  bool reload_incremental(FoodRowDelta * delta = nullptr) {
+    std::lock_guard<std::mutex> lock(_reload_mutex);
+    auto previous = current();
+    FoodRowDelta ignored;
+    if (!delta) {
+      delta = &ignored;
+    }
+    if (!load(previous.get(), delta)) {
+      return false;
+    }
+    if (previous && _listener) {
+      _listener(*previous, *current(), *delta);
+    }
+    return true;
+  }
+
+  // Have listener called after every incremental reload, including the
+  // watcher's, with the version replaced, the new current version and
+  // the changes between them. It runs on the reloading thread, before the
+  // next reload can start. Set it before start_watching().
+  void on_reload(std::function<void(const CatalogSnapshot &, const CatalogSnapshot &, const FoodRowDelta &)> listener) {
+    std::lock_guard<std::mutex> lock(_reload_mutex);
+    _listener = std::move(listener);
+  }
+
+  // Start a background thread that reloads, incrementally, whenever the
+  // file is written or replaced (e.g. renamed over). The directory is
+  // watched rather than the file, so replacing the file doesn't lose the
+  // watch. Returns false if watching isn't available. If waiting for
+  // changes fails, the thread reports it and stops watching.
+  bool start_watching() {
+#ifdef __linux__
+    if (_watcher.joinable()) {
+      return true;
+    }
+    std::string directory = ".", name = _path;
+    size_t slash = _path.rfind('/');
+    if (slash != std::string::npos) {
+      directory = slash == 0 ? "/" : _path.substr(0, slash);
+      name = _path.substr(slash + 1);
+    }
+
+    int inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (inotify_fd < 0 || inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+      if (inotify_fd >= 0) {
+        close(inotify_fd);
+      }
+      return false;
+    }
+    _stop_fd = eventfd(0, EFD_CLOEXEC);
+    _watcher = std::thread([this, inotify_fd, name]() {
+      watch(inotify_fd, name);
+      close(inotify_fd);
+    });
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void stop_watching() {
+#ifdef __linux__
+    if (!_watcher.joinable()) {
+      return;
+    }
+    uint64_t one = 1;
+    ssize_t ignored = write(_stop_fd, &one, sizeof(one));
+    (void) ignored;
+    _watcher.join();
+    close(_stop_fd);
+    _stop_fd = -1;
+#endif
+  }
+
+private:
+  // Read the file into a new snapshot and publish it. With a previous
+  // snapshot, rows are matched against it and delta is filled in.
+  bool load(const CatalogSnapshot * previous, FoodRowDelta * delta) {
+    CatalogInputStream f(_path);
+    if (!f) {
+      std::cout << "Failed to load food database; Cannot open file: " << _path << std::endl;
+      return false;
+    }
+
+    std::vector<bool> old_matched;
+    // Positions of the rows carried over whose position changed.
+    std::vector<size_t> moved;
+    size_t last_matched = 0;
+    if (previous) {
+      old_matched.assign(previous->foods->size(), false);
+    }
+
+    auto snapshot = std::make_shared<CatalogSnapshot>();
+    snapshot->foods.reset(new FoodVector);
+    std::vector<size_t> new_rows;
+    std::hash<std::string> hash_row;
+    FoodIdAssigner ids;
+
+    size_t line_number = 0;
+    std::string reason;
+    for (std::string line; std::getline(f, line);) {
+      line_number++;
+
+      // First line is a header row
+      if (line_number == 1) {
+        continue;
+      }
+
+      // A row keeps its ID while its text is unchanged; the row hash
+      // guards against an ID that happens to collide.
+      uint64_t row_hash = hash_row(line);
+      uint32_t id = ids.assign(line);
+      if (previous) {
+        auto found = previous->positions.find(id);
+        if (found != previous->positions.end() && previous->row_hashes[found->second] == row_hash) {
+          old_matched[found->second] = true;
+          if (delta->unchanged > 0 && found->second < last_matched) {
+            delta->reordered = true;
+          }
+          last_matched = found->second;
+          if (found->second != snapshot->foods->size()) {
+            moved.push_back(snapshot->foods->size());
+          }
+          snapshot->foods->push_back((*previous->foods)[found->second]);
+          snapshot->row_hashes.push_back(row_hash);
+          delta->unchanged++;
+          continue;
+        }
+      }
+
+      std::shared_ptr<FoodItem> item;
+      if (!parse_food_line(line, item, reason, id)) {
+        snapshot->load_errors.push_back(FoodLoadError{line_number, reason});
+        continue;
+      }
+      new_rows.push_back(snapshot->foods->size());
+      snapshot->foods->push_back(item);
+      snapshot->row_hashes.push_back(row_hash);
+    }
+
+    if (!f.error().empty()) {
+      std::cout << "Failed to load food database; Cannot read file: " << _path << ": " << f.error() << std::endl;
+      return false;
+    }
+
+    if (previous) {
+      // Pair up vanished and new rows with the same description as updates.
+      std::unordered_map<uint32_t, std::vector<size_t>> vanished;
+      for (size_t i = old_matched.size(); i-- > 0;) {
+        if (!old_matched[i]) {
+          vanished[(*previous->foods)[i]->description_id()].push_back(i);
+        }
+      }
+      for (size_t position: new_rows) {
+        auto found = vanished.find((*snapshot->foods)[position]->description_id());
+        if (found != vanished.end() && !found->second.empty()) {
+          delta->updated.emplace_back(found->second.back(), position);
+          old_matched[found->second.back()] = true;
+          found->second.pop_back();
+        } else {
+          delta->added.push_back(position);
+        }
+      }
+      for (size_t i = 0; i < old_matched.size(); i++) {
+        if (!old_matched[i]) {
+          delta->removed.push_back(i);
+        }
+      }
+
+      // Patch the previous positions: drop the rows that went, then place
+      // the new rows and the ones that moved.
+      snapshot->positions = previous->positions;
+      for (size_t i: delta->removed) {
+        snapshot->positions.erase((*previous->foods)[i]->id());
+      }
+      for (auto & update: delta->updated) {
+        snapshot->positions.erase((*previous->foods)[update.first]->id());
+      }
+      moved.insert(moved.end(), new_rows.begin(), new_rows.end());
+      for (size_t i: moved) {
+        snapshot->positions[(*snapshot->foods)[i]->id()] = i;
+      }
+    } else {
+      for (size_t i = 0; i < snapshot->foods->size(); i++) {
+        snapshot->positions[(*snapshot->foods)[i]->id()] = i;
+      }
+    }
+    snapshot->version = ++_versions;
+    _current.store(std::move(snapshot));
+    return true;
+  }
+
+#ifdef __linux__
+  void watch(int inotify_fd, const std::string & name) {
+    for (;;) {
+      pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {_stop_fd, POLLIN, 0}};
+      if (poll(fds, 2, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        std::cout << "Stopped watching food database: " << _path << ": " << std::strerror(errno) << std::endl;
+        return;
+      }
+      if (fds[1].revents) {
+        return;
+      }
+      bool changed = false;
+      alignas(inotify_event) char buffer[4096];
+      for (ssize_t got; (got = read(inotify_fd, buffer, sizeof(buffer))) > 0;) {
+        for (char * p = buffer; p < buffer + got;) {
+          auto event = reinterpret_cast<inotify_event *>(p);
+          if (event->len > 0 && name == event->name) {
+            changed = true;
+          }
+          p += sizeof(inotify_event) + event->len;
+        }
+      }
+      if (changed) {
+        reload_incremental();
+      }
+    }
+  }
+#endif
+
+  std::string _path;
+  std::atomic<std::shared_ptr<const CatalogSnapshot>> _current;
+  std::mutex _reload_mutex;
+  std::function<void(const CatalogSnapshot &, const CatalogSnapshot &, const FoodRowDelta &)> _listener;
+  uint64_t _versions;
+  std::thread _watcher;
+  int _stop_fd;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// catalog.hh
+///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,429 @@
+///////////////////////////////////////////////////////////////////////////////
+// catalogstream.hh
+//
+// Input stream over a catalog file that may be compressed. gzip and zstd
+// files are recognized by their magic bytes and decompressed on the fly,
+// so the loaders read them like the plain CSV, with no temporary file.
+//
+// How to use:
+//
+//  CatalogInputStream f("food.csv.gz");
+//  for (std::string line; std::getline(f, line);) { ... }
+//  if (!f.error().empty()) { ... the file couldn't be read completely ... }
+//
+// Plain files are read directly by the reading thread. Compressed files are
+// decompressed ahead, in chunks, by a task on the thread pool, which hands
+// them to the reading thread through a small queue, so decompression
+// overlaps with parsing. The task returns whenever the queue is full, so it
+// never holds a worker while the reader falls behind, and a reader that
+// runs dry before any worker has started the task runs it itself, so it
+// never waits behind other work on the pool.
+//
+// gzip needs zlib (MAXWEIGHT_USE_ZLIB) and zstd needs libzstd
+// (MAXWEIGHT_USE_ZSTD); the Makefile defines these when the libraries are
+// installed. Without them, such a file fails to load with an error saying
+// so.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#if defined(MAXWEIGHT_USE_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(MAXWEIGHT_USE_ZSTD)
+#include <zstd.h>
+#endif
+
+#include "mpmcqueue.hh"
+#include "threadpool.hh"
+
+enum class CatalogCompression { NONE, GZIP, ZSTD };
+
+// Which compression the first bytes of a file indicate.
+CatalogCompression detect_catalog_compression(const unsigned char * bytes, size_t size) {
+  if (size >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b) {
+    return CatalogCompression::GZIP;
+  }
+  if (size >= 4 && bytes[0] == 0x28 && bytes[1] == 0xb5 && bytes[2] == 0x2f && bytes[3] == 0xfd) {
+    return CatalogCompression::ZSTD;
+  }
+  return CatalogCompression::NONE;
+}
+
+class CatalogStreambuf : public std::streambuf {
+public:
+  // Compressed files are decompressed on pool; nullptr means
+  // default_thread_pool(), which plain files never touch.
+  explicit CatalogStreambuf(const std::string & path, ThreadPool * pool = nullptr)
+  : _file(std::fopen(path.c_str(), "rb")), _compression(CatalogCompression::NONE), _chunks(8),
+  _pool(nullptr), _started(false), _scheduled(false), _running(false), _finished(false) {
+    if (!_file) {
+      _error = std::strerror(errno);
+      return;
+    }
+    unsigned char magic[4];
+    size_t got = std::fread(magic, 1, sizeof(magic), _file);
+    _compression = detect_catalog_compression(magic, got);
+    std::rewind(_file);
+    if (_compression == CatalogCompression::NONE) {
+      return;
+    }
+    _pool = pool ? pool : &default_thread_pool();
+    _decoder.reset(new TaskGroup(*_pool));
+    _input.resize(CHUNK_BYTES);
+    if (start_decoding()) {
+      schedule();
+    } else {
+      _finished = true;
+      _chunks.close();
+    }
+  }
+
+  ~CatalogStreambuf() {
+    // Stops the decoder if the reader quit early.
+    _chunks.close();
+    if (_decoder) {
+      _decoder->wait();
+    }
+    finish_decoding();
+    if (_file) {
+      std::fclose(_file);
+    }
+  }
+
+  bool is_open() const {
+    return _file != nullptr;
+  }
+
+  CatalogCompression compression() const {
+    return _compression;
+  }
+
+  // Why the file couldn't be read to the end, or empty if it could (so far).
+  std::string error() const {
+    std::lock_guard<std::mutex> lock(_error_mutex);
+    return _error;
+  }
+
+protected:
+  int_type underflow() override {
+    if (gptr() != egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    if (_compression == CatalogCompression::NONE) {
+      if (!_file) {
+        return traits_type::eof();
+      }
+      _current.resize(CHUNK_BYTES);
+      size_t size = std::fread(&_current[0], 1, _current.size(), _file);
+      if (size == 0) {
+        if (std::ferror(_file)) {
+          fail(std::strerror(errno));
+        }
+        return traits_type::eof();
+      }
+      setg(&_current[0], &_current[0], &_current[0] + size);
+      return traits_type::to_int_type(*gptr());
+    }
+
+    for (;;) {
+      if (!_chunks.try_pop(_current)) {
+        // The decoding task may be queued behind other work, or behind
+        // the calling worker itself, so run it here if no worker has
+        // started it. Otherwise it is running, or done, and will push a
+        // chunk or close the queue.
+        if (!_chunks.closed()) {
+          schedule();
+          if (claim()) {
+            decode();
+            continue;
+          }
+        }
+        if (!_chunks.pop(_current)) {
+          return traits_type::eof();
+        }
+      }
+      // There is room in the queue again.
+      schedule();
+      setg(&_current[0], &_current[0], &_current[0] + _current.size());
+      return traits_type::to_int_type(*gptr());
+    }
+  }
+
+private:
+  static const size_t CHUNK_BYTES = 256 << 10;
+
+  void fail(const std::string & error) {
+    std::lock_guard<std::mutex> lock(_error_mutex);
+    _error = error;
+  }
+
+  // Read chunks of the file. Returns false at the end, or on an error.
+  bool read(std::vector<unsigned char> & buffer, size_t & size) {
+    size = std::fread(buffer.data(), 1, buffer.size(), _file);
+    if (size == 0 && std::ferror(_file)) {
+      fail(std::strerror(errno));
+    }
+    return size > 0;
+  }
+
+  // Queue a decoding task unless one is queued or running already, or
+  // decoding is over.
+  void schedule() {
+    std::lock_guard<std::mutex> lock(_state_mutex);
+    if (_scheduled || _running || _finished) {
+      return;
+    }
+    _scheduled = true;
+    _decoder->run([this]() {
+      if (claim()) {
+        decode();
+      }
+    });
+  }
+
+  // Take the queued decoding task, on a worker or on the reader, whichever
+  // gets there first. Returns false if it was taken already; then the task
+  // queued for it does nothing.
+  bool claim() {
+    std::lock_guard<std::mutex> lock(_state_mutex);
+    if (!_scheduled) {
+      return false;
+    }
+    _scheduled = false;
+    _running = true;
+    return true;
+  }
+
+  // Decompress chunks into the queue until it is full, and then return
+  // rather than block the worker; the reader schedules the next task once
+  // it has made room. At the end, or on an error, the queue is closed.
+  void decode() {
+    try {
+      for (;;) {
+        if (_held.empty() && !next_chunk(_held)) {
+          break;
+        }
+        // Pushing under the lock means a reader that took a chunk before
+        // this push sees _running still set, and one that takes it after
+        // finds the queue had room, so the last chunk always gets a task.
+        std::lock_guard<std::mutex> lock(_state_mutex);
+        if (_chunks.closed()) {
+          break;
+        }
+        if (!_chunks.try_push(_held)) {
+          _running = false;
+          return;
+        }
+        _held.clear();
+      }
+    } catch (const std::exception & e) {
+      fail(std::string("cannot decompress: ") + e.what());
+    }
+    std::lock_guard<std::mutex> lock(_state_mutex);
+    _finished = true;
+    _running = false;
+    _chunks.close();
+  }
+
+  // Set up the decompressor. Returns false on an error.
+  bool start_decoding() {
+    switch (_compression) {
+    case CatalogCompression::NONE:
+      break;
+
+    case CatalogCompression::GZIP:
+#if defined(MAXWEIGHT_USE_ZLIB)
+      // 32: accept gzip or zlib headers.
+      if (inflateInit2(&_gzip, 15 + 32) != Z_OK) {
+        fail("cannot initialize zlib");
+        return false;
+      }
+      _started = true;
+      _in_member = false;
+      return true;
+#else
+      fail("gzip input, but built without zlib");
+      return false;
+#endif
+
+    case CatalogCompression::ZSTD:
+#if defined(MAXWEIGHT_USE_ZSTD)
+      _zstd = ZSTD_createDStream();
+      ZSTD_initDStream(_zstd);
+      _started = true;
+      _zstd_in = ZSTD_inBuffer{_input.data(), 0, 0};
+      _zstd_full = false;
+      _zstd_remaining = 0;
+      return true;
+#else
+      fail("zstd input, but built without libzstd");
+      return false;
+#endif
+    }
+    return false;
+  }
+
+  void finish_decoding() {
+    if (!_started) {
+      return;
+    }
+#if defined(MAXWEIGHT_USE_ZLIB)
+    if (_compression == CatalogCompression::GZIP) {
+      inflateEnd(&_gzip);
+    }
+#endif
+#if defined(MAXWEIGHT_USE_ZSTD)
+    if (_compression == CatalogCompression::ZSTD) {
+      ZSTD_freeDStream(_zstd);
+    }
+#endif
+  }
+
+  // Decompress the next non-empty chunk into output. Returns false at the
+  // end, or on an error.
+  bool next_chunk(std::string & output) {
+    size_t size;
+    switch (_compression) {
+    case CatalogCompression::NONE:
+      break;
+
+    case CatalogCompression::GZIP:
+#if defined(MAXWEIGHT_USE_ZLIB)
+      for (;;) {
+        if (_gzip.avail_in == 0) {
+          if (!read(_input, size)) {
+            if (_in_member && error().empty()) {
+              fail("truncated gzip data");
+            }
+            return false;
+          }
+          _gzip.next_in = _input.data();
+          _gzip.avail_in = size;
+        }
+        output.assign(CHUNK_BYTES, '\0');
+        _gzip.next_out = reinterpret_cast<Bytef *>(&output[0]);
+        _gzip.avail_out = output.size();
+        _in_member = true;
+        int status = inflate(&_gzip, Z_NO_FLUSH);
+        if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+          fail(std::string("corrupt gzip data: ") + (_gzip.msg ? _gzip.msg : "unknown error"));
+          return false;
+        }
+        output.resize(output.size() - _gzip.avail_out);
+        if (status == Z_STREAM_END) {
+          // Concatenated gzip files decompress to the concatenation.
+          _in_member = false;
+          inflateReset(&_gzip);
+        }
+        if (!output.empty()) {
+          return true;
+        }
+      }
+#endif
+      break;
+
+    case CatalogCompression::ZSTD:
+#if defined(MAXWEIGHT_USE_ZSTD)
+      for (;;) {
+        // A full output buffer may mean more output is pending for the
+        // input already given.
+        if (_zstd_in.pos == _zstd_in.size && !_zstd_full) {
+          if (!read(_input, size)) {
+            if (_zstd_remaining != 0 && error().empty()) {
+              fail("truncated zstd data");
+            }
+            return false;
+          }
+          _zstd_in = ZSTD_inBuffer{_input.data(), size, 0};
+        }
+        output.assign(ZSTD_DStreamOutSize(), '\0');
+        ZSTD_outBuffer out{&output[0], output.size(), 0};
+        _zstd_remaining = ZSTD_decompressStream(_zstd, &out, &_zstd_in);
+        if (ZSTD_isError(_zstd_remaining)) {
+          fail(std::string("corrupt zstd data: ") + ZSTD_getErrorName(_zstd_remaining));
+          return false;
+        }
+        _zstd_full = out.pos == out.size;
+        output.resize(out.pos);
+        if (!output.empty()) {
+          return true;
+        }
+      }
+#endif
+      break;
+    }
+    (void) size;
+    return false;
+  }
+
+  std::FILE * _file;
+  CatalogCompression _compression;
+  MpmcQueue<std::string> _chunks;
+  std::string _current;
+  ThreadPool * _pool;
+  // Decompressor state, only touched by the decoding task (one at a time).
+  std::vector<unsigned char> _input;
+  std::string _held;
+  bool _started;
+#if defined(MAXWEIGHT_USE_ZLIB)
+  z_stream _gzip{};
+  bool _in_member;
+#endif
+#if defined(MAXWEIGHT_USE_ZSTD)
+  ZSTD_DStream * _zstd;
+  ZSTD_inBuffer _zstd_in;
+  bool _zstd_full;
+  size_t _zstd_remaining;
+#endif
+  std::mutex _state_mutex;
+  // A decoding task is queued but not claimed, or one is decoding.
+  bool _scheduled, _running, _finished;
+  std::unique_ptr<TaskGroup> _decoder;
+  mutable std::mutex _error_mutex;
+  std::string _error;
+};
+
+// std::istream over a CatalogStreambuf.
+class CatalogInputStream : public std::istream {
+public:
+  explicit CatalogInputStream(const std::string & path, ThreadPool * pool = nullptr)
+  : std::istream(nullptr), _buffer(path, pool) {
+    rdbuf(&_buffer);
+    if (!_buffer.is_open()) {
+      setstate(std::ios::failbit);
+    }
+  }
+
+  bool is_open() const {
+    return _buffer.is_open();
+  }
+
+  CatalogCompression compression() const {
+    return _buffer.compression();
+  }
+
+  // See CatalogStreambuf::error().
+  std::string error() const {
+    return _buffer.error();
+  }
+
+private:
+  CatalogStreambuf _buffer;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// catalogstream.hh
+///////////////////////////////////////////////////////////////////////////////
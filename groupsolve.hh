@@ -0,0 +1,170 @@
+///////////////////////////////////////////////////////////////////////////////
+// groupsolve.hh
+//
+// Divide and conquer over the food items instead of the calorie columns.
+//
+// grouped_dynamic_max_weight splits the items into groups and solves each
+// group on its own, in parallel, giving the group's profile: the best
+// weight within every calorie budget. Profiles are then merged pairwise in
+// a tree by (max, +) convolution,
+//
+//   merged[c] = max over a of left[a] + right[c - a],
+//
+// which also records the best split a of each budget c. Reconstruction
+// walks the tree from the root, handing each side its part of the budget,
+// down to the groups, whose own take bits give their items.
+//
+// A merge costs O(C^2) for C calorie columns against O(n C) for the
+// row-by-row table, so this pays off when there are many items per column
+// and workers to spare; unlike parallel_dynamic_max_weight it needs no
+// synchronization between rows.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "maxweight.hh"
+#include "threadpool.hh"
+
+// Value of a best-weight profile at column c. Profiles stop at the largest
+// total their items reach, and hold their last value beyond it.
+double profile_weight(const std::vector<double> & profile, size_t column) {
+  return profile[std::min(column, profile.size() - 1)];
+}
+
+// (max, +) convolution of two non-decreasing best-weight profiles, for
+// columns up to columns - 1 (the result stops earlier if both inputs do).
+// If split is given, split[c] receives the smallest a for which
+// left[a] + right[c - a] is the maximum. Columns are computed in parallel
+// on pool.
+std::vector<double> max_plus_convolution(
+  const std::vector<double> & left,
+    const std::vector<double> & right,
+    size_t columns,
+    std::vector<uint32_t> * split = nullptr,
+    ThreadPool & pool = default_thread_pool()
+) {
+  size_t width = std::min(columns, left.size() + right.size() - 1);
+  std::vector<double> merged(width);
+  if (split) {
+    split->assign(width, 0);
+  }
+  parallel_for(pool, 0, width, 256, [&](size_t begin, size_t end) {
+    for (size_t column = begin; column < end; column++) {
+      // Past the end of either profile, moving budget to it gains nothing.
+      size_t first = column >= right.size() ? column - (right.size() - 1) : 0;
+      size_t last = std::min(column, left.size() - 1);
+      double best = left[first] + right[column - first];
+      size_t best_split = first;
+      for (size_t a = first + 1; a <= last; a++) {
+        double weight = left[a] + right[column - a];
+        if (weight > best) {
+          best = weight;
+          best_split = a;
+        }
+      }
+      merged[column] = best;
+      if (split) {
+        (*split)[column] = best_split;
+      }
+    }
+  });
+  return merged;
+}
+
+// Compute an optimal set of food items, of the same total weight as
+// dynamic_max_weight's, by splitting foodItems into groups (0 means one
+// per worker of pool) solved in parallel and merged by (max, +)
+// convolution. Ties between equally good selections may be broken
+// differently. The chosen items are returned last item first.
+std::unique_ptr<FoodVector> grouped_dynamic_max_weight(
+  const FoodVector & foodItems,
+    double totalCalorieLimit,
+    size_t groups = 0,
+    ThreadPool & pool = default_thread_pool()
+) {
+  std::unique_ptr<FoodVector> optimalFoodSelection(new FoodVector);
+  if (totalCalorieLimit < 0 || foodItems.empty()) {
+    return optimalFoodSelection;
+  }
+
+  // No budget beyond the largest reachable total is of any use.
+  double limit = largest_reachable_calorie_total(foodItems, totalCalorieLimit);
+  size_t columns = static_cast<size_t>(limit) + 1;
+  if (groups == 0) {
+    groups = pool.size();
+  }
+  groups = std::max<size_t>(1, std::min(groups, foodItems.size()));
+
+  // A node of the merge tree covers groups [first_group, end_group). Leaves
+  // keep their group's items and table; inner nodes keep the best split of
+  // every budget between their two children.
+  struct Node {
+    size_t first_group, end_group;
+    std::vector<double> profile;
+    FoodVector foods;
+    size_t first_item = 0;
+    DynamicScratch scratch;
+    std::vector<uint32_t> split;
+    std::unique_ptr<Node> left, right;
+  };
+
+  std::function<void(Node &)> solve = [&](Node & node) {
+    if (node.end_group - node.first_group == 1) {
+      node.first_item = foodItems.size() * node.first_group / groups;
+      size_t end_item = foodItems.size() * node.end_group / groups;
+      node.foods.assign(foodItems.begin() + node.first_item, foodItems.begin() + end_item);
+      dynamic_max_weight_indices(node.foods, limit, node.scratch);
+      node.profile = std::move(node.scratch.previous_row);
+      node.scratch.current_row = std::vector<double>();
+      return;
+    }
+    size_t middle = (node.first_group + node.end_group) / 2;
+    node.left.reset(new Node{node.first_group, middle});
+    node.right.reset(new Node{middle, node.end_group});
+    TaskGroup children(pool);
+    children.run([&]() { solve(*node.left); });
+    solve(*node.right);
+    children.wait();
+    node.profile = max_plus_convolution(node.left->profile, node.right->profile, columns, &node.split, pool);
+    node.left->profile = std::vector<double>();
+    node.right->profile = std::vector<double>();
+  };
+
+  Node root{0, groups};
+  solve(root);
+
+  std::vector<size_t> selection;
+  std::function<void(const Node &, size_t)> reconstruct = [&](const Node & node, size_t budget) {
+    if (!node.left) {
+      const DynamicScratch & scratch = node.scratch;
+      for (size_t index: reconstruct_dynamic_selection(
+        node.foods, scratch.take_bits.data(), (scratch.columns + 63) / 64, budget, scratch.columns
+      )) {
+        selection.push_back(node.first_item + index);
+      }
+      return;
+    }
+    budget = std::min(budget, node.split.size() - 1);
+    size_t left_budget = node.split[budget];
+    reconstruct(*node.left, left_budget);
+    reconstruct(*node.right, budget - left_budget);
+  };
+  reconstruct(root, columns - 1);
+
+  std::sort(selection.rbegin(), selection.rend());
+  for (size_t index: selection) {
+    optimalFoodSelection->push_back(foodItems[index]);
+  }
+  return optimalFoodSelection;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// groupsolve.hh
+///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,148 @@
+///////////////////////////////////////////////////////////////////////////////
+// intervalsolve.hh
+//
+// Best weights of many solves, each restricted to a contiguous slice
+// [first, end) of a food list, answered together offline.
+//
+// How to use:
+//
+//  std::vector<IntervalQuery> queries = {{0, 100, 2000}, {40, 250, 1500}};
+//  std::vector<double> weights = interval_max_weights(foods, queries);
+//
+// The list is split at its midpoint m. A query with first <= m <= end is
+// answered there: a DP over the items going left from m gives row L_first
+// (items [first, m)), one going right gives row R_end (items [m, end)),
+// and
+//
+//   best weight of [first, end) = max over a of L_first[a] + R_end[C - a]
+//
+// The other queries lie wholly on one side, and are answered by splitting
+// that half the same way. Each level of the recursion passes over every
+// item once, so Q queries over n items cost O(n log n C + Q C) instead of
+// O(n C) each.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "maxweight.hh"
+
+// A solve over the items [first, end) of a list, within total_calorie.
+struct IntervalQuery {
+  size_t first, end;
+  double total_calorie;
+};
+
+// For each query, the best total weight dynamic_max_weight would find over
+// its slice of foodItems, in the same order as queries.
+// Only the right-going rows at the queries' distinct ends are kept while a
+// level is answered, so memory is O(min(Q, n) C).
+std::vector<double> interval_max_weights(
+  const FoodVector & foodItems,
+    const std::vector<IntervalQuery> & queries
+) {
+  std::vector<double> answers(queries.size(), 0);
+  double limit = -1;
+  std::vector<size_t> pending;
+  for (size_t q = 0; q < queries.size(); q++) {
+    assert(queries[q].first <= queries[q].end && queries[q].end <= foodItems.size());
+    // Empty slices and negative limits have nothing to choose from.
+    if (queries[q].first < queries[q].end && queries[q].total_calorie >= 0) {
+      limit = std::max(limit, queries[q].total_calorie);
+      pending.push_back(q);
+    }
+  }
+  if (pending.empty()) {
+    return answers;
+  }
+
+  // Every slice reaches a subset of the totals the whole list does.
+  std::vector<uint64_t> reachable = reachable_calorie_totals(foodItems, limit);
+  size_t columns = static_cast<size_t>(largest_reachable_calorie_total(reachable)) + 1;
+  std::vector<double> next(columns);
+  std::vector<uint64_t> take((columns + 63) / 64);
+  auto add = [&](std::vector<double> & row, size_t index) {
+    dynamic_programming_row(
+      row.data(), next.data(), take.data(), columns,
+      foodItems[index]->calorie(), foodItems[index]->weight(), reachable.data()
+    );
+    std::swap(row, next);
+  };
+
+  // Which of a level's kept rows is each query's end.
+  std::vector<size_t> end_row(queries.size());
+
+  // Answer the queries in queued, all within [low, high).
+  std::function<void(size_t, size_t, std::vector<size_t> &)> solve = [&](size_t low, size_t high, std::vector<size_t> & queued) {
+    if (queued.empty()) {
+      return;
+    }
+    size_t middle = low + (high - low) / 2;
+    std::vector<size_t> here, left, right;
+    for (size_t q: queued) {
+      if (queries[q].end < middle) {
+        left.push_back(q);
+      } else if (queries[q].first > middle) {
+        right.push_back(q);
+      } else {
+        here.push_back(q);
+      }
+    }
+    queued = std::vector<size_t>();
+
+    if (!here.empty()) {
+      // Going right: keep the row at each query's end.
+      std::sort(here.begin(), here.end(), [&](size_t a, size_t b) {
+        return queries[a].end < queries[b].end;
+      });
+      std::vector<std::vector<double>> ends;
+      std::vector<double> row(columns, 0);
+      size_t position = middle;
+      for (size_t q: here) {
+        if (!ends.empty() && queries[q].end == position) {
+          end_row[q] = ends.size() - 1;
+          continue;
+        }
+        for (; position < queries[q].end; position++) {
+          add(row, position);
+        }
+        ends.push_back(row);
+        end_row[q] = ends.size() - 1;
+      }
+
+      // Going left: combine with the kept rows.
+      std::sort(here.begin(), here.end(), [&](size_t a, size_t b) {
+        return queries[a].first > queries[b].first;
+      });
+      row.assign(columns, 0);
+      position = middle;
+      for (size_t q: here) {
+        for (; position > queries[q].first; position--) {
+          add(row, position - 1);
+        }
+        const std::vector<double> & end = ends[end_row[q]];
+        size_t budget = std::min(static_cast<size_t>(queries[q].total_calorie), columns - 1);
+        double best = 0;
+        for (size_t a = 0; a <= budget; a++) {
+          best = std::max(best, row[a] + end[budget - a]);
+        }
+        answers[q] = best;
+      }
+    }
+
+    solve(low, middle, left);
+    solve(middle + 1, high, right);
+  };
+  solve(0, foodItems.size(), pending);
+  return answers;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// intervalsolve.hh
+///////////////////////////////////////////////////////////////////////////////
@@ -8,16 +8,41 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <charconv>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <queue>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "catalogstream.hh"
+#include "stringpool.hh"
+#include "threadpool.hh"
+
+
+// ID of an item that wasn't loaded from a catalog row: a hash of its
+// description, calories and weight.
+uint32_t food_content_id(uint32_t description_id, double calories, double weight_ounces) {
+  uint64_t calorie_bits, weight_bits;
+  std::memcpy(&calorie_bits, &calories, sizeof(calorie_bits));
+  std::memcpy(&weight_bits, &weight_ounces, sizeof(weight_bits));
+  uint64_t hash = description_pool().hash(description_id).low;
+  hash = mix_hash64(hash ^ calorie_bits) + weight_bits;
+  return static_cast<uint32_t>(mix_hash64(hash));
+}
 
 // One food item available for purchase.
 class FoodItem {
@@ -29,16 +54,66 @@ class FoodItem {
       const std::string & description,
         double calories,
         double weight_ounces
-    ): _description(description),
+    ): _description_id(description_pool().intern(description)),
+  _id(food_content_id(_description_id, calories, weight_ounces)),
   _calories(calories),
   _weight_ounces(weight_ounces) {
     assert(!description.empty());
     assert(calories > 0);
   }
 
+  // With a description already interned in description_pool(), whose
+  // reference the item takes over, and the ID a FoodIdAssigner gave its
+  // row.
+  FoodItem(
+    uint32_t description_id,
+      double calories,
+      double weight_ounces,
+      uint32_t id
+  ): _description_id(description_id),
+  _id(id),
+  _calories(calories),
+  _weight_ounces(weight_ounces) {
+    assert(calories > 0);
+  }
+
+  // Each item holds a reference to its description.
+  FoodItem(const FoodItem & other)
+  : _description_id(other._description_id),
+  _id(other._id),
+  _calories(other._calories),
+  _weight_ounces(other._weight_ounces) {
+    description_pool().retain(_description_id);
+  }
+
+  FoodItem & operator=(const FoodItem & other) {
+    description_pool().retain(other._description_id);
+    description_pool().release(_description_id);
+    _description_id = other._description_id;
+    _id = other._id;
+    _calories = other._calories;
+    _weight_ounces = other._weight_ounces;
+    return *this;
+  }
+
+  ~FoodItem() {
+    description_pool().release(_description_id);
+  }
+
   //
   const std::string & description() const {
-    return _description;
+    return description_pool().get(_description_id);
+  }
+  // Items with equal descriptions have equal IDs, as long as one of them
+  // holds the description (see StringPool); a description interned again
+  // after its last item is gone gets a new ID.
+  uint32_t description_id() const {
+    return _description_id;
+  }
+  // Identifies the item within its catalog, and stays the same when the
+  // catalog is loaded again (see FoodIdAssigner).
+  uint32_t id() const {
+    return _id;
   }
   double calorie() const {
     return _calories;
@@ -50,8 +125,11 @@ class FoodItem {
   //
   private:
 
-    // Human-readable description of the food, e.g. "spicy chicken breast". Must be non-empty.
-    std::string _description;
+    // Human-readable description of the food, e.g. "spicy chicken breast",
+    // interned in description_pool(). Must be non-empty.
+    uint32_t _description_id;
+
+  uint32_t _id;
 
   // Calories; Must be positive
   double _calories;
@@ -60,16 +138,154 @@ class FoodItem {
   double _weight_ounces;
 };
 
+// Gives the rows of one load of a catalog their item IDs: a hash of the
+// row's text and of the number of identical rows before it. So a row keeps
+// its ID across loads as long as it is in the file, whatever else changes.
+// IDs that collide within a load (rare with 32 bits) move on to the next
+// free value.
+class FoodIdAssigner {
+public:
+  uint32_t assign(std::string_view row) {
+    if (!row.empty() && row.back() == '\r') {
+      row.remove_suffix(1);
+    }
+    StringHash hash = hash_string(row);
+    uint32_t occurrence = _occurrences[hash.low]++;
+    uint32_t id = static_cast<uint32_t>(mix_hash64(hash.high + occurrence));
+    while (!_used.insert(id).second) {
+      id++;
+    }
+    return id;
+  }
+
+private:
+  std::unordered_map<uint64_t, uint32_t> _occurrences;
+  std::unordered_set<uint32_t> _used;
+};
+
 // Alias for a vector of shared pointers to FoodItem objects.
 typedef std::vector < std::shared_ptr < FoodItem >> FoodVector;
 
-// Load all the valid food items from the CSV database
-// Food items that are missing fields, or have invalid values, are skipped.
+// Why one row of the CSV database was skipped.
+struct FoodLoadError {
+  size_t line_number;
+  std::string reason;
+};
+
+// What load_food_database read: the number of data rows, and an error for
+// each row that was skipped.
+struct FoodLoadReport {
+  size_t rows = 0;
+  std::vector<FoodLoadError> errors;
+};
+
+// Parse a whole field as a finite number, ignoring surrounding spaces.
+// Unlike stream extraction this doesn't depend on the locale, and rejects
+// empty fields and trailing garbage.
+bool parse_food_number(std::string_view field, double & output) {
+  while (!field.empty() && (field.front() == ' ' || field.front() == '\t')) {
+    field.remove_prefix(1);
+  }
+  while (!field.empty() && (field.back() == ' ' || field.back() == '\t')) {
+    field.remove_suffix(1);
+  }
+  const char * end = field.data() + field.size();
+  auto result = std::from_chars(field.data(), end, output);
+  return result.ec == std::errc() && result.ptr == end && std::isfinite(output);
+}
+
+// The fields of one data row of the CSV database. The description points
+// into the line it was parsed from.
+struct FoodRow {
+  std::string_view description;
+  double calories, weight_ounces;
+};
+
+// Parse one data row of the CSV database into row, without making a
+// FoodItem, so nothing is interned. Loaders that keep only some rows make
+// items of those alone, with make_food_item.
+// Returns false, with the reason in reason, if the row is invalid and
+// should be skipped: it doesn't have exactly 3 fields, the description is
+// empty, or the calories aren't a positive number or the weight isn't a
+// number.
+bool parse_food_row(std::string_view line, FoodRow & row, std::string & reason) {
+  if (!line.empty() && line.back() == '\r') {
+    line.remove_suffix(1);
+  }
+
+  std::string_view fields[3];
+  size_t count = 0;
+  for (size_t start = 0;; count++) {
+    size_t caret = line.find('^', start);
+    if (count < 3) {
+      fields[count] = line.substr(start, caret - start);
+    }
+    if (caret == std::string_view::npos) {
+      count++;
+      break;
+    }
+    start = caret + 1;
+  }
+  if (count != 3) {
+    reason = "invalid field count; want 3 but got " + std::to_string(count);
+    return false;
+  }
+
+  if (fields[0].empty()) {
+    reason = "empty description";
+    return false;
+  }
+  if (!parse_food_number(fields[1], row.calories) || row.calories <= 0) {
+    reason = "calories must be a positive number, got \"" + std::string(fields[1]) + "\"";
+    return false;
+  }
+  if (!parse_food_number(fields[2], row.weight_ounces)) {
+    reason = "weight must be a number, got \"" + std::string(fields[2]) + "\"";
+    return false;
+  }
+  row.description = fields[0];
+  return true;
+}
+
+// The item for a row from parse_food_row, with the given ID (from a
+// FoodIdAssigner), or else one derived from its contents.
+std::shared_ptr<FoodItem> make_food_item(const FoodRow & row, std::optional<uint32_t> id = std::nullopt) {
+  uint32_t description_id = description_pool().intern(row.description);
+  return std::make_shared<FoodItem>(
+    description_id,
+    row.calories,
+    row.weight_ounces,
+    id ? *id : food_content_id(description_id, row.calories, row.weight_ounces)
+  );
+}
+
+// Parse one data row of the CSV database into item, as parse_food_row and
+// make_food_item do. Returns false, leaving item null and the reason in
+// reason, if the row is invalid and should be skipped.
+bool parse_food_line(
+  std::string_view line,
+    std::shared_ptr<FoodItem> & item,
+    std::string & reason,
+    std::optional<uint32_t> id = std::nullopt
+) {
+  item.reset();
+  FoodRow row;
+  if (!parse_food_row(line, row, reason)) {
+    return false;
+  }
+  item = make_food_item(row, id);
+  return true;
+}
+
+// Load all the valid food items from the CSV database, which may be gzip
+// or zstd compressed (see catalogstream.hh).
+// Rows that are missing fields, or have invalid values, are skipped; if
+// report is given, it receives the line number and reason for each.
 // Returns nullptr on I/O error.
-std::unique_ptr <FoodVector> load_food_database(const std::string & path) {
+std::unique_ptr <FoodVector> load_food_database(const std::string & path, FoodLoadReport * report = nullptr) {
   std::unique_ptr <FoodVector> failure(nullptr);
 
-  std::ifstream f(path);
+  CatalogInputStream f(path);
   if (!f) {
     std::cout << "Failed to load food database; Cannot open file: " << path << std::endl;
     return failure;
@@ -78,6 +294,8 @@ std::unique_ptr <FoodVector> load_food_database(const std::string & path) {
   std::unique_ptr <FoodVector> result(new FoodVector);
 
   size_t line_number = 0;
+  std::string reason;
+  FoodIdAssigner ids;
   for (std::string line; std::getline(f, line);) {
     line_number++;
 
@@ -86,55 +304,21 @@ std::unique_ptr <FoodVector> load_food_database(const std::string & path) {
       continue;
     }
 
-    std::vector < std::string > fields;
-    std::stringstream ss(line);
-
-    for (std::string field; std::getline(ss, field, '^');) {
-      fields.push_back(field);
-    }
-
-    if (fields.size() != 3) {
-      std::cout <<
-        "Failed to load food database: Invalid field count at line " << line_number << "; Want 3 but got " << fields.size() << std::endl <<
-        "Line: " << line << std::endl;
-      return failure;
+    if (report) {
+      report->rows++;
     }
-
-    std::string
-    descr_field = fields[0],
-      calories_field = fields[1],
-      weight_ounces_field = fields[2];
-
-    auto parse_dbl = [](const std::string & field, double & output) {
-      std::stringstream ss(field);
-      if (!ss) {
-        return false;
-      }
-
-      ss >> output;
-
-      return true;
-    };
-
-    std::string description(descr_field);
-    double calories, weight_ounces;
-    if (
-      parse_dbl(calories_field, calories) &&
-      parse_dbl(weight_ounces_field, weight_ounces)
-    ) {
-      result -> push_back(
-        std::shared_ptr < FoodItem > (
-          new FoodItem(
-            description,
-            calories,
-            weight_ounces
-          )
-        )
-      );
+    std::shared_ptr < FoodItem > item;
+    if (parse_food_line(line, item, reason, ids.assign(line))) {
+      result -> push_back(item);
+    } else if (report) {
+      report->errors.push_back(FoodLoadError{line_number, reason});
     }
   }
 
-  f.close();
+  if (!f.error().empty()) {
+    std::cout << "Failed to load food database; Cannot read file: " << path << ": " << f.error() << std::endl;
+    return failure;
+  }
 
   return result;
 }
@@ -222,6 +406,262 @@ std::unique_ptr <FoodVector> filter_food_vector(
   return result;
 }
 
+// The calorie totals up to totalCalorieLimit that some subset of
+// foodItems adds up to exactly, as a bitset: bit c % 64 of word c / 64 is
+// set if total c is reachable. Calories are rounded up, the way the
+// dynamic programming table counts them.
+// This is a subset sum over bits, reach |= reach << calories for each
+// item, so it does 64 columns per operation where the table does one; the
+// shift loop has no branches, so the compiler can vectorize it.
+std::vector<uint64_t> reachable_calorie_totals(
+  const FoodVector & foodItems,
+    double totalCalorieLimit
+) {
+  if (totalCalorieLimit < 0) {
+    return std::vector<uint64_t>();
+  }
+  std::size_t columns = static_cast<std::size_t>(totalCalorieLimit) + 1;
+  std::size_t words = (columns + 63) / 64;
+  std::vector<uint64_t> reach(words, 0), shifted(words);
+  reach[0] = 1;
+  for (auto & food: foodItems) {
+    double calories = std::ceil(food->calorie());
+    if (calories >= columns) {
+      continue;
+    }
+    std::size_t wordShift = static_cast<std::size_t>(calories) / 64;
+    unsigned bitShift = static_cast<std::size_t>(calories) % 64;
+    // Bits carried over from the word below; a shift by 64 is undefined,
+    // hence the two steps.
+    for (size_t word = wordShift; word < words; word++) {
+      uint64_t low = word > wordShift ? reach[word - wordShift - 1] : 0;
+      shifted[word] = (reach[word - wordShift] << bitShift) | ((low >> 1) >> (63 - bitShift));
+    }
+    for (size_t word = wordShift; word < words; word++) {
+      reach[word] |= shifted[word];
+    }
+  }
+  // Drop totals past the limit in the last word.
+  if (columns % 64) {
+    reach[words - 1] &= (uint64_t(1) << (columns % 64)) - 1;
+  }
+  return reach;
+}
+
+// The largest total in reachable (from reachable_calorie_totals), or -1 if
+// there is none.
+double largest_reachable_calorie_total(const std::vector<uint64_t> & reachable) {
+  for (size_t word = reachable.size(); word-- > 0;) {
+    if (reachable[word]) {
+      return word * 64 + 63 - __builtin_clzll(reachable[word]);
+    }
+  }
+  return -1;
+}
+
+// The largest calorie total, up to totalCalorieLimit, that some subset of
+// foodItems adds up to. The best selection within totalCalorieLimit is
+// also the best within this total, so a solve only needs the table up to
+// it; when it equals totalCalorieLimit, the whole budget can be used.
+// Returns -1 if totalCalorieLimit is negative.
+double largest_reachable_calorie_total(
+  const FoodVector & foodItems,
+    double totalCalorieLimit
+) {
+  return largest_reachable_calorie_total(reachable_calorie_totals(foodItems, totalCalorieLimit));
+}
+
+// Largest calorie limit a request from outside (the daemon, the batch
+// solver) may ask for; the DP table is one column per calorie.
+const double MAX_TOTAL_CALORIE = 1e8;
+
+// Reusable working memory for dynamic_max_weight.
+// Only two rows of the dynamic programming table are live at a time; the
+// rest of the table is kept as one "take" bit per cell, which is set when
+// the item of that row changed the best weight for that calorie column.
+// That bit is all the reconstruction step needs. Passing the same scratch
+// to many solves reuses its allocations.
+struct DynamicScratch {
+  std::vector<double> previous_row, current_row;
+  std::vector<uint64_t> take_bits;
+  // Width of the last table built: the calorie limit plus one, or less if
+  // no total above some column was reachable. Every column from there up
+  // to the limit is the same as the last one.
+  std::size_t columns = 0;
+};
+
+// Fill one row of the dynamic programming table: current from previous,
+// for an item with the given calories and weight, plus the row's take bits
+// (all of wordsPerRow words are written).
+// If reachable (from reachable_calorie_totals over all the table's items)
+// is given, words of 64 columns none of which is reachable are copied from
+// the column before them instead of computed: with no subset adding up to
+// those totals, the best weight within each is the best within the one
+// before, in every row.
+void dynamic_programming_row(
+  const double * previous,
+    double * current,
+    uint64_t * take,
+    std::size_t columns,
+    double foodCalories,
+    double foodWeight,
+    const uint64_t * reachable = nullptr
+) {
+  for (size_t word = 0; word * 64 < columns; word++) {
+    uint64_t bits = 0;
+    size_t end = std::min(columns, word * 64 + 64);
+    if (reachable && word > 0 && reachable[word] == 0) {
+      std::fill(current + word * 64, current + end, current[word * 64 - 1]);
+      if (take[word - 1] >> 63) {
+        bits = ~uint64_t(0) >> (64 - (end - word * 64));
+      }
+      take[word] = bits;
+      continue;
+    }
+    for (size_t calorie = word * 64; calorie < end; calorie++) {
+      if (foodCalories <= calorie) {
+        current[calorie] = std::max(previous[calorie], previous[static_cast<size_t>(calorie - foodCalories)] + foodWeight);
+      } else {
+        current[calorie] = previous[calorie];
+      }
+      if (current[calorie] != previous[calorie]) {
+        bits |= uint64_t(1) << (calorie % 64);
+      }
+    }
+    take[word] = bits;
+  }
+}
+
+// Construct the optimal food selection for totalCalorieLimit from the take
+// bits of a dynamic programming table over itemCount items, where
+// itemCalories(i) is the calories of item i, and return the positions of
+// the chosen items, last item first. takeRow(i) returns the take bits of
+// the row for item i; rows are visited from the last item to the first.
+// The columns of the table don't depend on its width, so a table built
+// for a larger limit gives the same selection as one built for this limit.
+// A table cut off at tableColumns (see DynamicScratch::columns) is read as
+// if its last column went on up to the limit.
+template <typename ItemCalories, typename TakeRow>
+std::vector<size_t> reconstruct_dynamic_selection(
+  std::size_t itemCount,
+    ItemCalories itemCalories,
+    TakeRow takeRow,
+    double totalCalorieLimit,
+    std::size_t tableColumns = SIZE_MAX
+) {
+  std::vector<size_t> optimalFoodSelection;
+  int index = itemCount;
+  int remainingCalories = totalCalorieLimit;
+  // Start from the bottom right corner of the table
+  while (index > 0 && remainingCalories > 0) {
+    const uint64_t * take = takeRow(index - 1);
+    size_t column = std::min<size_t>(remainingCalories, tableColumns - 1);
+    if (take[column / 64] & (uint64_t(1) << (column % 64))) {
+      optimalFoodSelection.push_back(index - 1);
+      remainingCalories -= itemCalories(index - 1);
+    }
+    index--;
+  }
+  return optimalFoodSelection;
+}
+
+// Same as above, for the items in foodItems.
+template <typename TakeRow>
+std::vector<size_t> reconstruct_dynamic_selection(
+  const FoodVector & foodItems,
+    TakeRow takeRow,
+    double totalCalorieLimit,
+    std::size_t tableColumns = SIZE_MAX
+) {
+  return reconstruct_dynamic_selection(
+    foodItems.size(),
+    [&](size_t index) { return foodItems[index]->calorie(); },
+    takeRow,
+    totalCalorieLimit,
+    tableColumns
+  );
+}
+
+// Same as above, for take bits stored row after row with wordsPerRow words
+// per row.
+std::vector<size_t> reconstruct_dynamic_selection(
+  const FoodVector & foodItems,
+    const uint64_t * takeBits,
+    std::size_t wordsPerRow,
+    double totalCalorieLimit,
+    std::size_t tableColumns = SIZE_MAX
+) {
+  return reconstruct_dynamic_selection(
+    foodItems,
+    [&](size_t index) { return takeBits + index * wordsPerRow; },
+    totalCalorieLimit,
+    tableColumns
+  );
+}
+
+// Compute the optimal set of food items with dynamic programming, using
+// (and growing if needed) the buffers in scratch, and return the positions
+// in foodItems of the chosen items, last item first.
+// A bitset pass over the calorie totals first (reachable_calorie_totals)
+// cuts the table off at the largest reachable total, and lets the rows
+// skip runs of unreachable columns.
+// If cancelled is given and becomes true, the solve stops at the next row
+// and returns an empty selection.
+std::vector<size_t> dynamic_max_weight_indices(
+  const FoodVector & foodItems,
+    double totalCalorieLimit,
+    DynamicScratch & scratch,
+    const std::atomic<bool> * cancelled = nullptr
+) {
+  std::vector<size_t> optimalFoodSelection;
+  if (totalCalorieLimit < 0) {
+    return optimalFoodSelection;
+  }
+
+  std::vector<uint64_t> reachable = reachable_calorie_totals(foodItems, totalCalorieLimit);
+
+  // Initialize the dynamic programming rows and take bits
+  std::size_t foodCount = foodItems.size();
+  std::size_t columns = static_cast<std::size_t>(largest_reachable_calorie_total(reachable)) + 1;
+  std::size_t wordsPerRow = (columns + 63) / 64;
+  scratch.columns = columns;
+  scratch.previous_row.assign(columns, 0);
+  scratch.current_row.resize(columns);
+  scratch.take_bits.resize(foodCount * wordsPerRow);
+
+  for (size_t index = 1; index <= foodCount; index++) {
+    if (cancelled && cancelled->load(std::memory_order_relaxed)) {
+      return optimalFoodSelection;
+    }
+    dynamic_programming_row(
+      scratch.previous_row.data(),
+      scratch.current_row.data(),
+      scratch.take_bits.data() + (index - 1) * wordsPerRow,
+      columns,
+      foodItems[index - 1]->calorie(),
+      foodItems[index - 1]->weight(),
+      reachable.data()
+    );
+    std::swap(scratch.previous_row, scratch.current_row);
+  }
+
+  return reconstruct_dynamic_selection(foodItems, scratch.take_bits.data(), wordsPerRow, totalCalorieLimit, columns);
+}
+
+// Compute the optimal set of food items with dynamic programming, using
+// (and growing if needed) the buffers in scratch.
+std::unique_ptr<FoodVector> dynamic_max_weight(
+  const FoodVector & foodItems,
+    double totalCalorieLimit,
+    DynamicScratch & scratch
+) {
+  std::unique_ptr<FoodVector> optimalFoodSelection(new FoodVector);
+  for (size_t index: dynamic_max_weight_indices(foodItems, totalCalorieLimit, scratch)) {
+    optimalFoodSelection->push_back(foodItems[index]);
+  }
+  return optimalFoodSelection;
+}
+
 // Compute the optimal set of food items with dynamic programming.
 // Specifically, among the food items that fit within a total_calories,
 // choose the foods whose weight-per-calorie is largest.
@@ -231,31 +671,165 @@ std::unique_ptr<FoodVector> dynamic_max_weight(
   const FoodVector & foodItems,
     double totalCalorieLimit
 ) {
-  // Create a copy of the food items vector.
-  std::unique_ptr<FoodVector> foodSource(new FoodVector(foodItems));
+  DynamicScratch scratch;
+  return dynamic_max_weight(foodItems, totalCalorieLimit, scratch);
+}
+
+// One independent problem for batch_max_weight: a food list and the
+// calorie limit to solve it for. The food list must outlive the call.
+struct DynamicJob {
+  const FoodVector * foods;
+  double total_calorie;
+};
+
+// Solve many independent problems with dynamic_max_weight on pool, and
+// return the solutions in the same order as jobs.
+// Jobs are grouped into size classes by table size (powers of two of
+// items times calorie columns) and queued largest class first, so each
+// worker's scratch grows to its final size early and the small jobs fill in
+// at the end. Each worker reuses one DynamicScratch for all the jobs it runs.
+std::vector<std::unique_ptr<FoodVector>> batch_max_weight(
+  const std::vector<DynamicJob> & jobs,
+    ThreadPool & pool = default_thread_pool()
+) {
+  std::vector<std::unique_ptr<FoodVector>> results(jobs.size());
+
+  auto size_class = [&](size_t job) {
+    double cells = (jobs[job].foods->size() + 1) * (std::max(jobs[job].total_calorie, 0.0) + 1);
+    return std::ilogb(cells);
+  };
+  std::vector<size_t> order(jobs.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return size_class(a) > size_class(b);
+  });
+
+  // One scratch per worker, plus one for the calling thread, which helps
+  // while it waits.
+  std::vector<DynamicScratch> scratches(pool.size() + 1);
+  parallel_for(pool, 0, order.size(), 1, [&](size_t begin, size_t end) {
+    int worker = pool.current_worker();
+    DynamicScratch & scratch = scratches[worker >= 0 ? worker : pool.size()];
+    for (size_t claimed = begin; claimed < end; claimed++) {
+      size_t job = order[claimed];
+      results[job] = dynamic_max_weight(*jobs[job].foods, jobs[job].total_calorie, scratch);
+    }
+  });
+  return results;
+}
+
+// Compute the same optimal set of food items as dynamic_max_weight, with
+// the calorie columns split into one partition per worker of pool, filled
+// in parallel one row at a time.
+// Each partition owns its slice of the rolling rows and its own block of
+// take bits, sized in multiples of 64 columns so no two workers share a
+// word. When first_touch is true, each partition is allocated and zeroed by
+// the worker that computes it, so that on a NUMA machine its pages land on
+// that worker's node (pin the pool's workers, e.g. with numa_worker_cpus(),
+// for this to stick). With first_touch false the calling thread allocates
+// everything, which is useful to measure the difference.
+// Each row's partitions run on their own workers, so every partition is
+// only ever written from its node. With steal, idle workers and the calling
+// thread may take them instead, so one busy worker doesn't hold up the row,
+// at the price of writing partitions across nodes.
+std::unique_ptr<FoodVector> parallel_dynamic_max_weight(
+  const FoodVector & foodItems,
+    double totalCalorieLimit,
+    ThreadPool & pool = default_thread_pool(),
+    bool first_touch = true,
+    bool steal = false
+) {
   std::unique_ptr<FoodVector> optimalFoodSelection(new FoodVector);
+  if (totalCalorieLimit < 0) {
+    return optimalFoodSelection;
+  }
+
+  struct Partition {
+    size_t first_column, end_column, words;
+    std::vector<double> previous_row, current_row;
+    std::vector<uint64_t> take_bits;
+  };
 
-  // Initialize the dynamic programming table
   std::size_t foodCount = foodItems.size();
-  std::vector<std::vector<double>> dpTable(foodCount + 1, std::vector<double>(totalCalorieLimit + 1, 0));
-  // Initialize the first row of the table
+  std::size_t columns = static_cast<std::size_t>(totalCalorieLimit) + 1;
+  std::size_t totalWords = (columns + 63) / 64;
+  // At least 16 words (1024 columns) per partition, so the per-row
+  // fork/join pays for itself.
+  std::size_t partitionCount = std::max<size_t>(1, std::min<size_t>(pool.size(), totalWords / 16));
+  std::size_t partitionColumns = 64 * ((totalWords + partitionCount - 1) / partitionCount);
+  partitionCount = (columns + partitionColumns - 1) / partitionColumns;
+
+  std::vector<Partition> partitions(partitionCount);
+  auto allocate = [&](size_t p) {
+    Partition & part = partitions[p];
+    part.first_column = p * partitionColumns;
+    part.end_column = std::min(columns, part.first_column + partitionColumns);
+    part.words = (part.end_column - part.first_column + 63) / 64;
+    part.previous_row.assign(part.end_column - part.first_column, 0);
+    part.current_row.assign(part.end_column - part.first_column, 0);
+    part.take_bits.assign(foodCount * part.words, 0);
+  };
+
+  // Run body(p) for every partition p on its own worker, or, unless pinned,
+  // on whichever thread steals it first.
+  auto for_each_partition = [&](auto body, bool pinned) {
+    if (partitionCount == 1) {
+      body(0);
+      return;
+    }
+    TaskGroup group(pool);
+    for (size_t p = 0; p < partitionCount; p++) {
+      group.run_on(p, [&body, p]() { body(p); }, !pinned);
+    }
+    group.wait();
+  };
+
+  if (first_touch) {
+    for_each_partition(allocate, true);
+  } else {
+    for (size_t p = 0; p < partitionCount; p++) {
+      allocate(p);
+    }
+  }
+
   for (size_t index = 1; index <= foodCount; index++) {
-    for (int calorie = 0; calorie <= totalCalorieLimit; calorie++) {
-      if ((*foodSource)[index - 1]->calorie() <= calorie) {
-        dpTable[index][calorie] = std::max(dpTable[index-1][calorie], dpTable[index-1][calorie - (*foodSource)[index-1]->calorie()] + (*foodSource)[index-1]->weight());
-      } else {
-        dpTable[index][calorie] = dpTable[index-1][calorie];
+    double foodCalories = foodItems[index - 1]->calorie();
+    double foodWeight = foodItems[index - 1]->weight();
+    for_each_partition([&](size_t p) {
+      Partition & part = partitions[p];
+      uint64_t * take = part.take_bits.data() + (index - 1) * part.words;
+      for (size_t calorie = part.first_column; calorie < part.end_column; calorie++) {
+        size_t offset = calorie - part.first_column;
+        double previous = part.previous_row[offset];
+        double current = previous;
+        if (foodCalories <= calorie) {
+          size_t source = static_cast<size_t>(calorie - foodCalories);
+          const Partition & owner = partitions[source / partitionColumns];
+          current = std::max(previous, owner.previous_row[source - owner.first_column] + foodWeight);
+        }
+        part.current_row[offset] = current;
+        if (current != previous) {
+          take[offset / 64] |= uint64_t(1) << (offset % 64);
+        }
       }
+    }, !steal);
+    // Every partition has finished this row, so the rows can be swapped.
+    for (auto & part: partitions) {
+      std::swap(part.previous_row, part.current_row);
     }
   }
-  // Construct the optimal food selection
+
   int index = foodCount;
   int remainingCalories = totalCalorieLimit;
-  // Start from the bottom right corner of the table
   while (index > 0 && remainingCalories > 0) {
-    if (dpTable[index][remainingCalories] != dpTable[index-1][remainingCalories]) {
-      optimalFoodSelection->emplace_back((*foodSource)[index-1]);
-      remainingCalories -= (*foodSource)[index-1]->calorie();
+    const Partition & part = partitions[remainingCalories / partitionColumns];
+    const uint64_t * take = part.take_bits.data() + (index - 1) * part.words;
+    size_t offset = remainingCalories - part.first_column;
+    if (take[offset / 64] & (uint64_t(1) << (offset % 64))) {
+      optimalFoodSelection->emplace_back(foodItems[index-1]);
+      remainingCalories -= foodItems[index-1]->calorie();
     }
     index--;
   }
@@ -296,4 +870,80 @@ std::unique_ptr <FoodVector> exhaustive_max_weight(const FoodVector & foods, dou
     }
   }
   return best_subset;
-}
\ No newline at end of file
+}
+
+// Compute the optimal set of food items with exhaustive search, like
+// exhaustive_max_weight, but from tables holding the calorie and weight
+// totals of every subset instead of re-summing each subset from scratch.
+// The tables are filled one item at a time: once they cover items 0..j-1,
+// the half-space of masks [2^j, 2^(j+1)) is the lower half-space [0, 2^j)
+// plus item j, i.e. sum[mask] = sum[mask without its top bit] + item[j].
+// Each half-space is a dependency-free loop the compiler can vectorize,
+// and large ones are split across pool.
+// Ties are broken the same way as exhaustive_max_weight, so both return
+// the same subset.
+// The tables take O(2^n) memory, so the size of the food items vector must
+// be at most 26.
+std::unique_ptr<FoodVector> exhaustive_max_weight_table(
+  const FoodVector & foods,
+    double total_calorie,
+    ThreadPool & pool = default_thread_pool()
+) {
+  assert(foods.size() <= 26);
+
+  // Masks per parallel task; smaller tables are done on the calling thread.
+  const size_t grain = size_t(1) << 16;
+
+  size_t sub_count = size_t(1) << foods.size();
+  std::vector<double> calorie_sums(sub_count), weight_sums(sub_count);
+  calorie_sums[0] = weight_sums[0] = 0.0;
+
+  for (size_t j = 0; j < foods.size(); ++j) {
+    size_t half = size_t(1) << j;
+    double calories = foods[j] -> calorie(), weight = foods[j] -> weight();
+    const double * low_calories = calorie_sums.data();
+    const double * low_weights = weight_sums.data();
+    double * high_calories = calorie_sums.data() + half;
+    double * high_weights = weight_sums.data() + half;
+    parallel_for(pool, 0, half, grain, [&](size_t begin, size_t end) {
+      for (size_t mask = begin; mask < end; ++mask) {
+        high_calories[mask] = low_calories[mask] + calories;
+        high_weights[mask] = low_weights[mask] + weight;
+      }
+    });
+  }
+
+  // Each chunk finds its first best mask; chunks are then combined in
+  // order, so the overall pick is the same as a sequential scan.
+  size_t chunk_count = (sub_count + grain - 1) / grain;
+  std::vector<size_t> chunk_masks(chunk_count, 0);
+  std::vector<double> chunk_weights(chunk_count, 0.0);
+  parallel_for(pool, 0, chunk_count, 1, [&](size_t first_chunk, size_t last_chunk) {
+    for (size_t chunk = first_chunk; chunk < last_chunk; ++chunk) {
+      size_t end = std::min(sub_count, (chunk + 1) * grain);
+      for (size_t mask = chunk * grain; mask < end; ++mask) {
+        if (calorie_sums[mask] <= total_calorie && weight_sums[mask] > chunk_weights[chunk]) {
+          chunk_weights[chunk] = weight_sums[mask];
+          chunk_masks[chunk] = mask;
+        }
+      }
+    }
+  });
+
+  size_t best_mask = 0;
+  double best_weight = 0.0;
+  for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+    if (chunk_weights[chunk] > best_weight) {
+      best_weight = chunk_weights[chunk];
+      best_mask = chunk_masks[chunk];
+    }
+  }
+
+  auto best_subset = std::make_unique<FoodVector>();
+  for (size_t j = 0; j < foods.size(); ++j) {
+    if (best_mask & (size_t(1) << j)) {
+      best_subset -> push_back(foods[j]);
+    }
+  }
+  return best_subset;
+}
@@ -0,0 +1,498 @@
+///////////////////////////////////////////////////////////////////////////////
+// maxweight_batch.cc
+//
+// Streaming batch solver for offline pipelines. Reads one JSON request per
+// line, solves the requests in parallel on default_thread_pool() with a
+// bounded number in flight, and writes one JSON result per line to stdout,
+// in input order. Throughput stats go to stderr at the end.
+//
+// Request fields (all optional except total_calorie):
+//   {"id": 17, "min_weight": 1, "max_weight": 2500, "total_size": 100,
+//    "total_calorie": 2000, "solver": "dynamic"}
+// solver is "dynamic" (the default) or "exhaustive". id, if present, must
+// be a JSON string or number, and is echoed back. Numbers must be finite;
+// total_size is a whole number of items up to 2^31 - 1, and total_calorie
+// at most MAX_TOTAL_CALORIE.
+//
+// Result:
+//   {"id": 17, "line": 1, "status": "ok", "calories": 1995, "weight": 8600.5,
+//    "items": [{"index": 3, "item_id": 2654435769, "description": "...",
+//               "calories": 83, "weight": 551.95}, ...]}
+// or, for a request that can't be parsed or solved:
+//   {"line": 2, "status": "error", "error": "..."}
+//
+// Usage: maxweight_batch [requests_jsonl|-] [food_csv]
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include "maxweight.hh"
+#include "solvercache.hh"
+#include "threadpool.hh"
+#include "timer.hh"
+
+using namespace std;
+
+// Append code point code to out as UTF-8.
+void append_utf8(string & out, unsigned code)
+{
+  if (code < 0x80)
+  {
+    out += static_cast<char>(code);
+  }
+  else if (code < 0x800)
+  {
+    out += static_cast<char>(0xc0 | (code >> 6));
+    out += static_cast<char>(0x80 | (code & 0x3f));
+  }
+  else if (code < 0x10000)
+  {
+    out += static_cast<char>(0xe0 | (code >> 12));
+    out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+    out += static_cast<char>(0x80 | (code & 0x3f));
+  }
+  else
+  {
+    out += static_cast<char>(0xf0 | (code >> 18));
+    out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+    out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+    out += static_cast<char>(0x80 | (code & 0x3f));
+  }
+}
+
+// Parse a flat JSON object of string, number, boolean and null values into
+// raw value tokens by key (strings are unescaped, other values kept as
+// written). Returns false, with a reason in error, if line isn't one.
+bool parse_flat_json(const string & line, map<string, string> & fields, map<string, string> & raw, string & error)
+{
+  size_t i = 0;
+  auto skip_space = [&]()
+  {
+    while (i < line.size() && isspace(static_cast<unsigned char>(line[i])))
+    {
+      i++;
+    }
+  };
+  // The four hex digits of a \u escape starting at line[at].
+  auto parse_hex4 = [&](size_t at, unsigned & code)
+  {
+    if (at + 4 > line.size())
+    {
+      return false;
+    }
+    code = 0;
+    for (size_t k = at; k < at + 4; k++)
+    {
+      char c = line[k];
+      if (!isxdigit(static_cast<unsigned char>(c)))
+      {
+        return false;
+      }
+      code = code * 16 + (isdigit(static_cast<unsigned char>(c)) ? c - '0' : tolower(c) - 'a' + 10);
+    }
+    return true;
+  };
+  auto parse_string = [&](string & out)
+  {
+    if (i >= line.size() || line[i] != '"')
+    {
+      return false;
+    }
+    for (i++; i < line.size() && line[i] != '"'; i++)
+    {
+      if (line[i] != '\\')
+      {
+        out += line[i];
+        continue;
+      }
+      if (++i >= line.size())
+      {
+        return false;
+      }
+      switch (line[i])
+      {
+        case 'n': out += '\n'; break;
+        case 't': out += '\t'; break;
+        case 'r': out += '\r'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'u':
+        {
+          unsigned code;
+          if (!parse_hex4(i + 1, code))
+          {
+            return false;
+          }
+          i += 4;
+          if (code >= 0xd800 && code <= 0xdbff)
+          {
+            // Outside the BMP: a high surrogate, then an escaped low one.
+            unsigned low;
+            if (i + 2 >= line.size() || line[i + 1] != '\\' || line[i + 2] != 'u' ||
+                !parse_hex4(i + 3, low) || low < 0xdc00 || low > 0xdfff)
+            {
+              return false;
+            }
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            i += 6;
+          }
+          else if (code >= 0xdc00 && code <= 0xdfff)
+          {
+            return false;
+          }
+          append_utf8(out, code);
+          break;
+        }
+        default: out += line[i]; break;
+      }
+    }
+    if (i >= line.size())
+    {
+      return false;
+    }
+    i++;
+    return true;
+  };
+
+  skip_space();
+  if (i >= line.size() || line[i] != '{')
+  {
+    error = "expected a JSON object";
+    return false;
+  }
+  i++;
+  skip_space();
+  if (i < line.size() && line[i] == '}')
+  {
+    i++;
+  }
+  else
+  {
+    for (;;)
+    {
+      string key, value;
+      skip_space();
+      if (!parse_string(key))
+      {
+        error = "expected a string key";
+        return false;
+      }
+      skip_space();
+      if (i >= line.size() || line[i] != ':')
+      {
+        error = "expected ':' after \"" + key + "\"";
+        return false;
+      }
+      i++;
+      skip_space();
+      size_t start = i;
+      if (i < line.size() && line[i] == '"')
+      {
+        if (!parse_string(value))
+        {
+          error = "unterminated or malformed string for \"" + key + "\"";
+          return false;
+        }
+      }
+      else if (i < line.size() && (line[i] == '{' || line[i] == '['))
+      {
+        error = "nested values are not supported (\"" + key + "\")";
+        return false;
+      }
+      else
+      {
+        while (i < line.size() && line[i] != ',' && line[i] != '}' && !isspace(static_cast<unsigned char>(line[i])))
+        {
+          i++;
+        }
+        value = line.substr(start, i - start);
+        if (value.empty())
+        {
+          error = "missing value for \"" + key + "\"";
+          return false;
+        }
+      }
+      fields[key] = value;
+      raw[key] = line.substr(start, i - start);
+      skip_space();
+      if (i < line.size() && line[i] == ',')
+      {
+        i++;
+        continue;
+      }
+      if (i < line.size() && line[i] == '}')
+      {
+        i++;
+        break;
+      }
+      error = "expected ',' or '}'";
+      return false;
+    }
+  }
+  skip_space();
+  if (i != line.size())
+  {
+    error = "trailing characters after the object";
+    return false;
+  }
+  return true;
+}
+
+string json_string(const string & value)
+{
+  ostringstream out;
+  out << '"';
+  for (char c : value)
+  {
+    switch (c)
+    {
+      case '"': out << "\\\""; break;
+      case '\\': out << "\\\\"; break;
+      case '\n': out << "\\n"; break;
+      case '\t': out << "\\t"; break;
+      case '\r': out << "\\r"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20)
+        {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          out << escaped;
+        }
+        else
+        {
+          out << c;
+        }
+    }
+  }
+  out << '"';
+  return out.str();
+}
+
+// Everything shared by the solver tasks: the catalog, loaded once, and
+// caches of positions and solutions.
+struct BatchContext
+{
+  unique_ptr<FoodVector> foods;
+  // By item ID.
+  unordered_map<uint32_t, size_t> positions;
+  SolverCache solutions{256 << 20, 1 << 30};
+};
+
+// One formatted output line, and whether it reports an error.
+struct BatchResult
+{
+  string line;
+  bool failed;
+};
+
+// Solve the request on one input line and format its result line. Any
+// failure, including an exception from the solvers, becomes an error
+// result for the line.
+BatchResult solve_line(BatchContext & context, const string & line, size_t line_number)
+{
+  map<string, string> fields, raw;
+  string error;
+  // The "id" member of the result, re-serialized from the request.
+  string id;
+
+  ostringstream out;
+  out << setprecision(15) << '{';
+  auto finish_error = [&](const string & message)
+  {
+    ostringstream failure;
+    failure << '{' << id << "\"line\": " << line_number << ", \"status\": \"error\", \"error\": " << json_string(message) << '}';
+    return BatchResult{failure.str(), true};
+  };
+
+  if (!parse_flat_json(line, fields, raw, error))
+  {
+    return finish_error(error);
+  }
+  if (raw.count("id"))
+  {
+    static const regex json_number("-?(0|[1-9][0-9]*)(\\.[0-9]+)?([eE][+-]?[0-9]+)?");
+    if (!raw["id"].empty() && raw["id"][0] == '"')
+    {
+      id = "\"id\": " + json_string(fields["id"]) + ", ";
+    }
+    else if (regex_match(raw["id"], json_number))
+    {
+      id = "\"id\": " + raw["id"] + ", ";
+    }
+    else
+    {
+      return finish_error("\"id\" must be a string or a number");
+    }
+  }
+  out << id;
+
+  try
+  {
+
+    auto number = [&](const string & key, double fallback, double & value)
+    {
+      if (!fields.count(key))
+      {
+        value = fallback;
+        return true;
+      }
+      char * end = nullptr;
+      value = strtod(fields[key].c_str(), &end);
+      return end && *end == '\0' && !fields[key].empty() && isfinite(value);
+    };
+
+    double min_weight, max_weight, total_size, total_calorie;
+    if (!fields.count("total_calorie"))
+    {
+      return finish_error("missing \"total_calorie\"");
+    }
+    if (!number("min_weight", 0, min_weight) ||
+        !number("max_weight", 1e300, max_weight) ||
+        !number("total_size", context.foods->size(), total_size) ||
+        !number("total_calorie", 0, total_calorie))
+    {
+      return finish_error("numeric fields must be finite numbers");
+    }
+    if (total_size < 0 || total_size > INT_MAX || total_size != floor(total_size))
+    {
+      return finish_error("\"total_size\" must be a whole number from 0 to 2147483647");
+    }
+    if (total_calorie > MAX_TOTAL_CALORIE)
+    {
+      return finish_error("\"total_calorie\" must be at most 100000000");
+    }
+    string solver = fields.count("solver") ? fields["solver"] : "dynamic";
+
+    auto filtered = filter_food_vector(*context.foods, min_weight, max_weight, static_cast<int>(total_size));
+    unique_ptr<FoodVector> solution;
+    if (solver == "dynamic")
+    {
+      solution = context.solutions.dynamic_max_weight(*filtered, total_calorie);
+    }
+    else if (solver == "exhaustive")
+    {
+      if (filtered->size() > 26)
+      {
+        return finish_error("exhaustive search is limited to 26 items");
+      }
+      solution = exhaustive_max_weight_table(*filtered, total_calorie);
+    }
+    else
+    {
+      return finish_error("unknown solver \"" + solver + "\"");
+    }
+
+    double calories, weight;
+    sum_food_vector(*solution, calories, weight);
+    out << "\"line\": " << line_number << ", \"status\": \"ok\", \"calories\": " << calories
+      << ", \"weight\": " << weight << ", \"items\": [";
+    for (size_t i = 0; i < solution->size(); i++)
+    {
+      auto & food = (*solution)[i];
+      out << (i ? ", " : "") << "{\"index\": " << context.positions.at(food->id())
+        << ", \"item_id\": " << food->id()
+        << ", \"description\": " << json_string(food->description())
+        << ", \"calories\": " << food->calorie()
+        << ", \"weight\": " << food->weight() << '}';
+    }
+    out << "]}";
+    return BatchResult{out.str(), false};
+  }
+  catch (const exception & e)
+  {
+    return finish_error(string("cannot solve: ") + e.what());
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  string requests_path = argc > 1 ? argv[1] : "-";
+  string food_path = argc > 2 ? argv[2] : "food.csv";
+
+  ifstream requests_file;
+  if (requests_path != "-")
+  {
+    requests_file.open(requests_path);
+    if (!requests_file)
+    {
+      cerr << "Cannot open requests file: " << requests_path << endl;
+      return 1;
+    }
+  }
+  istream & requests = requests_path == "-" ? cin : requests_file;
+
+  BatchContext context;
+  context.foods = load_food_database(food_path);
+  if (!context.foods)
+  {
+    return 1;
+  }
+  for (size_t i = 0; i < context.foods->size(); i++)
+  {
+    context.positions[(*context.foods)[i]->id()] = i;
+  }
+
+  ThreadPool & pool = default_thread_pool();
+  // Enough requests in flight to keep every worker busy while the oldest
+  // one is written out, but bounded so a huge input isn't read all at once.
+  const size_t max_in_flight = 4 * pool.size();
+
+  deque<future<BatchResult>> in_flight;
+  size_t line_number = 0, solved = 0, failed = 0;
+  auto write_oldest = [&]()
+  {
+    BatchResult result = in_flight.front().get();
+    in_flight.pop_front();
+    if (result.failed)
+    {
+      failed++;
+    }
+    solved++;
+    cout << result.line << '\n';
+  };
+
+  Timer timer;
+  for (string line; getline(requests, line);)
+  {
+    line_number++;
+    if (line.find_first_not_of(" \t\r") == string::npos)
+    {
+      continue;
+    }
+    auto task = make_shared<packaged_task<BatchResult()>>([&context, line, line_number]()
+    {
+      return solve_line(context, line, line_number);
+    });
+    in_flight.push_back(task->get_future());
+    pool.submit([task]() { (*task)(); });
+    if (in_flight.size() >= max_in_flight)
+    {
+      write_oldest();
+    }
+  }
+  while (!in_flight.empty())
+  {
+    write_oldest();
+  }
+  cout.flush();
+
+  double seconds = timer.elapsed();
+  cerr << "requests: " << solved << " (" << failed << " failed)"
+    << ", seconds: " << seconds
+    << ", requests/second: " << (seconds > 0 ? solved / seconds : 0) << endl;
+  return 0;
+}
@@ -0,0 +1,184 @@
+///////////////////////////////////////////////////////////////////////////////
+// maxweight_client.hh
+//
+// Client library for maxweight_daemon.
+//
+// How to use:
+//
+//  MaxWeightClient client("/tmp/maxweight.sock");
+//  if (client.connected()) {
+//    // dynamic programming over the catalog filtered to weights in [1, 2500]
+//    auto solution = client.solve(1, 2500, 100000, 2000);
+//    if (solution) {
+//      print_food_vector(*solution);
+//    }
+//  }
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cerrno>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "maxweight.hh"
+#include "maxweight_protocol.hh"
+
+// A blocking connection to maxweight_daemon. Not thread-safe; use one
+// client per thread.
+class MaxWeightClient {
+public:
+  explicit MaxWeightClient(const std::string & socket_path)
+  : _fd(-1), _next_request_id(1) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+      std::cout << "Failed to connect to daemon; Socket path too long: " << socket_path << std::endl;
+      return;
+    }
+    std::strcpy(address.sun_path, socket_path.c_str());
+
+    _fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_fd < 0 || ::connect(_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+      std::cout << "Failed to connect to daemon; Cannot connect to: " << socket_path << std::endl;
+      close();
+    }
+  }
+
+  MaxWeightClient(const MaxWeightClient &) = delete;
+  MaxWeightClient & operator=(const MaxWeightClient &) = delete;
+
+  ~MaxWeightClient() {
+    close();
+  }
+
+  bool connected() const {
+    return _fd >= 0;
+  }
+
+  // filter_food_vector on the daemon's catalog.
+  // Returns nullptr on error.
+  std::unique_ptr<FoodVector> filter(double min_weight, double max_weight, int total_size) {
+    maxweight_protocol::Request request;
+    request.op = maxweight_protocol::FILTER;
+    request.min_weight = min_weight;
+    request.max_weight = max_weight;
+    request.total_size = total_size;
+    return call(request);
+  }
+
+  // Solve within total_calorie over the daemon's catalog, filtered as by
+  // filter(). Returns nullptr on error.
+  std::unique_ptr<FoodVector> solve(
+    double min_weight,
+      double max_weight,
+      int total_size,
+      double total_calorie,
+      maxweight_protocol::Solver solver = maxweight_protocol::DYNAMIC
+  ) {
+    maxweight_protocol::Request request;
+    request.op = maxweight_protocol::SOLVE;
+    request.solver = solver;
+    request.min_weight = min_weight;
+    request.max_weight = max_weight;
+    request.total_size = total_size;
+    request.total_calorie = total_calorie;
+    return call(request);
+  }
+
+  // Send a request and wait for its response. Returns false, and closes
+  // the connection, on I/O or protocol errors.
+  bool call(maxweight_protocol::Request request, maxweight_protocol::Response & response) {
+    if (!connected()) {
+      return false;
+    }
+    request.request_id = _next_request_id++;
+    std::string frame = maxweight_protocol::encode_request(request);
+    uint32_t size;
+    std::string payload;
+    if (!write_all(frame.data(), frame.size()) ||
+        !read_all(reinterpret_cast<char *>(&size), sizeof(size)) ||
+        size > maxweight_protocol::MAX_FRAME_BYTES) {
+      close();
+      return false;
+    }
+    payload.resize(size);
+    if (!read_all(&payload[0], size) ||
+        !maxweight_protocol::decode_response(payload.data(), size, response) ||
+        response.request_id != request.request_id) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+private:
+  std::unique_ptr<FoodVector> call(const maxweight_protocol::Request & request) {
+    maxweight_protocol::Response response;
+    if (!call(request, response)) {
+      std::cout << "Daemon request failed; Connection lost" << std::endl;
+      return nullptr;
+    }
+    if (response.status != maxweight_protocol::OK) {
+      std::cout << "Daemon request failed: " << response.error << std::endl;
+      return nullptr;
+    }
+    auto result = std::make_unique<FoodVector>();
+    for (auto & item: response.items) {
+      result->push_back(std::make_shared<FoodItem>(
+        description_pool().intern(item.description), item.calories, item.weight, item.item_id
+      ));
+    }
+    return result;
+  }
+
+  bool write_all(const char * data, size_t size) {
+    while (size > 0) {
+      ssize_t written = ::send(_fd, data, size, MSG_NOSIGNAL);
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+      if (written <= 0) {
+        return false;
+      }
+      data += written;
+      size -= written;
+    }
+    return true;
+  }
+
+  bool read_all(char * data, size_t size) {
+    while (size > 0) {
+      ssize_t got = ::recv(_fd, data, size, 0);
+      if (got < 0 && errno == EINTR) {
+        continue;
+      }
+      if (got <= 0) {
+        return false;
+      }
+      data += got;
+      size -= got;
+    }
+    return true;
+  }
+
+  void close() {
+    if (_fd >= 0) {
+      ::close(_fd);
+      _fd = -1;
+    }
+  }
+
+  int _fd;
+  uint32_t _next_request_id;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// maxweight_client.hh
+///////////////////////////////////////////////////////////////////////////////
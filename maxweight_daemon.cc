@@ -0,0 +1,566 @@
+///////////////////////////////////////////////////////////////////////////////
+// maxweight_daemon.cc
+//
+// Long-running solver daemon. Loads the food catalog once (and again in
+// the background whenever the file changes), keeps filtered views and
+// solutions cached, and serves filter/solve requests from
+// MaxWeightClient over a Unix domain socket (see maxweight_protocol.hh).
+//
+// One thread runs an epoll loop that does all the socket I/O; requests are
+// solved on default_thread_pool(), which hands finished responses back to
+// the loop through an eventfd.
+//
+// Usage: maxweight_daemon [socket_path] [food_csv]
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "catalog.hh"
+#include "maxweight.hh"
+#include "maxweight_protocol.hh"
+#include "solvercache.hh"
+#include "threadpool.hh"
+
+using namespace maxweight_protocol;
+
+// The catalog, reloaded when its file changes, plus everything derived
+// from it that is worth keeping warm between requests.
+class Catalog
+{
+public:
+  explicit Catalog(const std::string & path)
+  : _holder(path), _solutions(256 << 20, 1 << 30)
+  {
+    _holder.on_reload([this](const CatalogSnapshot & previous, const CatalogSnapshot & current, const FoodRowDelta & delta)
+    {
+      carry_over_filters(previous, current, delta);
+    });
+  }
+
+  CatalogHolder & holder()
+  {
+    return _holder;
+  }
+
+  // filter_food_vector over one version of the catalog, remembering recent
+  // results; a reload keeps those it can't have changed. The filter itself
+  // runs without the lock, so requests with different filters don't wait
+  // for each other.
+  std::shared_ptr<const FoodVector> filter(const CatalogSnapshot & snapshot, double min_weight, double max_weight, int total_size)
+  {
+    auto key = std::make_tuple(snapshot.version, min_weight, max_weight, total_size);
+    {
+      std::lock_guard<std::mutex> lock(_filters_mutex);
+      auto found = _filters.find(key);
+      if (found != _filters.end())
+      {
+        return found->second;
+      }
+    }
+    std::shared_ptr<const FoodVector> filtered(filter_food_vector(*snapshot.foods, min_weight, max_weight, total_size));
+    std::lock_guard<std::mutex> lock(_filters_mutex);
+    if (_filters.size() >= 1024)
+    {
+      _filters.clear();
+    }
+    // Another request may have filtered the same way meanwhile; either
+    // result will do.
+    return _filters.emplace(key, filtered).first->second;
+  }
+
+  // Solutions are keyed by the fingerprint of the items, so they stay
+  // valid across reloads.
+  SolverCache & solutions()
+  {
+    return _solutions;
+  }
+
+private:
+  // Re-key the previous version's filter results for the current version
+  // wherever the reload can't have changed them: no row that came, went or
+  // changed passes the filter, and the rows that stayed kept their order.
+  void carry_over_filters(const CatalogSnapshot & previous, const CatalogSnapshot & current, const FoodRowDelta & delta)
+  {
+    if (delta.reordered)
+    {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(_filters_mutex);
+    std::vector<std::pair<std::tuple<uint64_t, double, double, int>, std::shared_ptr<const FoodVector>>> kept;
+    for (auto & entry : _filters)
+    {
+      if (std::get<0>(entry.first) != previous.version)
+      {
+        continue;
+      }
+      double min_weight = std::get<1>(entry.first), max_weight = std::get<2>(entry.first);
+      auto passes = [&](const FoodVector & foods, size_t position)
+      {
+        double weight = foods[position]->weight();
+        return weight >= min_weight && weight <= max_weight;
+      };
+      bool affected = false;
+      for (size_t position : delta.added)
+      {
+        affected = affected || passes(*current.foods, position);
+      }
+      for (size_t position : delta.removed)
+      {
+        affected = affected || passes(*previous.foods, position);
+      }
+      for (auto & update : delta.updated)
+      {
+        affected = affected || passes(*previous.foods, update.first) || passes(*current.foods, update.second);
+      }
+      if (!affected)
+      {
+        auto key = entry.first;
+        std::get<0>(key) = current.version;
+        kept.emplace_back(key, entry.second);
+      }
+    }
+    _filters.insert(kept.begin(), kept.end());
+  }
+
+  CatalogHolder _holder;
+  std::mutex _filters_mutex;
+  std::map<std::tuple<uint64_t, double, double, int>, std::shared_ptr<const FoodVector>> _filters;
+  SolverCache _solutions;
+};
+
+Response handle_request(Catalog & catalog, const Request & request)
+{
+  Response response;
+  response.request_id = request.request_id;
+  if (request.op == SOLVE && !(std::isfinite(request.total_calorie) && request.total_calorie <= MAX_TOTAL_CALORIE))
+  {
+    response.status = ERROR;
+    response.error = "total_calorie must be a finite number up to 100000000";
+    return response;
+  }
+
+  // Pin one version of the catalog for the whole request.
+  auto snapshot = catalog.holder().current();
+  auto filtered = catalog.filter(*snapshot, request.min_weight, request.max_weight, request.total_size);
+  std::unique_ptr<FoodVector> result;
+  if (request.op == FILTER)
+  {
+    result.reset(new FoodVector(*filtered));
+  }
+  else if (request.solver == DYNAMIC)
+  {
+    result = catalog.solutions().dynamic_max_weight(*filtered, request.total_calorie);
+  }
+  else if (filtered->size() <= 26)
+  {
+    result = exhaustive_max_weight_table(*filtered, request.total_calorie);
+  }
+  else
+  {
+    response.status = ERROR;
+    response.error = "exhaustive search is limited to 26 items";
+    return response;
+  }
+
+  for (auto & food : *result)
+  {
+    response.items.push_back(ResponseItem{
+      snapshot->positions.at(food->id()), food->id(), food->calorie(), food->weight(), food->description()
+    });
+  }
+  return response;
+}
+
+// Identifiers in epoll_event.data for the fixed descriptors; connections
+// are numbered from FIRST_CONNECTION up and never reuse a number, so a
+// late response for a closed connection can't reach a new one.
+const uint64_t LISTENER = 0, COMPLETIONS = 1, SIGNALS = 2, FIRST_CONNECTION = 16;
+
+struct Connection
+{
+  int fd;
+  std::string input, output;
+  // The epoll events watched for.
+  uint32_t events;
+  // Requests dispatched whose responses haven't been queued in output yet.
+  size_t pending;
+  // The client has shut down its side; the connection closes once every
+  // response has been written.
+  bool finished;
+};
+
+class Daemon
+{
+public:
+  Daemon(Catalog & catalog, ThreadPool & pool)
+  : _catalog(catalog), _solves(pool), _next_connection(FIRST_CONNECTION) { }
+
+  // The signals that stop the daemon. They must be blocked, with
+  // sigprocmask, before any thread is started, so that they are only
+  // received through the loop's signalfd.
+  static sigset_t shutdown_signals()
+  {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    return signals;
+  }
+
+  // Listen on socket_path and serve until SIGINT or SIGTERM. Returns false
+  // if the socket can't be set up.
+  bool run(const std::string & socket_path)
+  {
+    sigset_t signals = shutdown_signals();
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+      std::cout << "Socket path too long: " << socket_path << std::endl;
+      return false;
+    }
+    std::strcpy(address.sun_path, socket_path.c_str());
+    ::unlink(socket_path.c_str());
+
+    int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0 ||
+        ::bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        ::listen(listener, SOMAXCONN) != 0)
+    {
+      std::cout << "Cannot listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+      return false;
+    }
+
+    _epoll = ::epoll_create1(EPOLL_CLOEXEC);
+    _completions = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int signal_fd = ::signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    watch(listener, LISTENER, EPOLLIN);
+    watch(_completions, COMPLETIONS, EPOLLIN);
+    watch(signal_fd, SIGNALS, EPOLLIN);
+
+    std::cout << "Serving on " << socket_path << std::endl;
+    for (bool running = true; running;)
+    {
+      epoll_event events[64];
+      int count = ::epoll_wait(_epoll, events, 64, -1);
+      if (count < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      for (int i = 0; i < count; i++)
+      {
+        uint64_t id = events[i].data.u64;
+        if (id == LISTENER)
+        {
+          accept_all(listener);
+        }
+        else if (id == COMPLETIONS)
+        {
+          deliver_completions();
+        }
+        else if (id == SIGNALS)
+        {
+          running = false;
+        }
+        else if (events[i].events & (EPOLLHUP | EPOLLERR))
+        {
+          // Gone in both directions, so responses can't be delivered.
+          if (_connections.count(id))
+          {
+            close_connection(id);
+          }
+        }
+        else if (events[i].events & EPOLLIN)
+        {
+          if (!read_requests(id))
+          {
+            if (_connections.count(id))
+            {
+              close_connection(id);
+            }
+          }
+          else
+          {
+            flush(id);
+          }
+        }
+        else if (events[i].events & EPOLLOUT)
+        {
+          flush(id);
+        }
+      }
+    }
+
+    std::cout << "Shutting down" << std::endl;
+    // Solver tasks still in the pool refer to this daemon.
+    _solves.wait();
+    while (!_connections.empty())
+    {
+      close_connection(_connections.begin()->first);
+    }
+    ::close(listener);
+    ::close(signal_fd);
+    ::unlink(socket_path.c_str());
+    return true;
+  }
+
+  ~Daemon()
+  {
+    if (_epoll >= 0)
+    {
+      ::close(_epoll);
+    }
+    if (_completions >= 0)
+    {
+      ::close(_completions);
+    }
+  }
+
+private:
+  void watch(int fd, uint64_t id, uint32_t events)
+  {
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = id;
+    ::epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event);
+  }
+
+  void accept_all(int listener)
+  {
+    for (;;)
+    {
+      int fd = ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0)
+      {
+        return;
+      }
+      uint64_t id = _next_connection++;
+      _connections[id] = Connection{fd, std::string(), std::string(), EPOLLIN | EPOLLRDHUP, 0, false};
+      watch(fd, id, EPOLLIN | EPOLLRDHUP);
+    }
+  }
+
+  // Read what is available and dispatch every complete frame to the pool.
+  // At the end of the input the connection is marked finished, and stays
+  // open until its responses are written. Returns false when it should be
+  // closed at once.
+  bool read_requests(uint64_t id)
+  {
+    auto found = _connections.find(id);
+    if (found == _connections.end())
+    {
+      return true;
+    }
+    Connection & connection = found->second;
+
+    bool failed = false;
+    char buffer[65536];
+    for (;;)
+    {
+      ssize_t got = ::recv(connection.fd, buffer, sizeof(buffer), 0);
+      if (got > 0)
+      {
+        connection.input.append(buffer, got);
+        continue;
+      }
+      if (got < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (got == 0)
+      {
+        connection.finished = true;
+      }
+      else
+      {
+        failed = !(errno == EAGAIN || errno == EWOULDBLOCK);
+      }
+      break;
+    }
+
+    size_t offset = 0;
+    while (connection.input.size() - offset >= sizeof(uint32_t))
+    {
+      uint32_t size;
+      std::memcpy(&size, connection.input.data() + offset, sizeof(size));
+      if (size > MAX_FRAME_BYTES)
+      {
+        return false;
+      }
+      if (connection.input.size() - offset - sizeof(size) < size)
+      {
+        break;
+      }
+      Request request;
+      if (!decode_request(connection.input.data() + offset + sizeof(size), size, request))
+      {
+        return false;
+      }
+      offset += sizeof(size) + size;
+      connection.pending++;
+      dispatch(id, request);
+    }
+    connection.input.erase(0, offset);
+    return !failed;
+  }
+
+  void dispatch(uint64_t id, const Request & request)
+  {
+    _solves.run([this, id, request]()
+    {
+      Response response;
+      try
+      {
+        response = handle_request(_catalog, request);
+      }
+      catch (const std::exception & error)
+      {
+        response = Response();
+        response.request_id = request.request_id;
+        response.status = ERROR;
+        response.error = error.what();
+      }
+      std::string frame = encode_response(response);
+      {
+        std::lock_guard<std::mutex> lock(_completed_mutex);
+        _completed.emplace_back(id, std::move(frame));
+      }
+      uint64_t one = 1;
+      ssize_t ignored = ::write(_completions, &one, sizeof(one));
+      (void) ignored;
+    });
+  }
+
+  void deliver_completions()
+  {
+    uint64_t counter;
+    ssize_t ignored = ::read(_completions, &counter, sizeof(counter));
+    (void) ignored;
+
+    std::vector<std::pair<uint64_t, std::string>> completed;
+    {
+      std::lock_guard<std::mutex> lock(_completed_mutex);
+      completed.swap(_completed);
+    }
+    for (auto & done : completed)
+    {
+      auto found = _connections.find(done.first);
+      if (found != _connections.end())
+      {
+        found->second.pending--;
+        found->second.output += done.second;
+        flush(done.first);
+      }
+    }
+  }
+
+  // Write as much pending output as the socket takes, and watch for
+  // writability only while some is left. Closes a finished connection once
+  // nothing is left to write.
+  void flush(uint64_t id)
+  {
+    auto found = _connections.find(id);
+    if (found == _connections.end())
+    {
+      return;
+    }
+    Connection & connection = found->second;
+    size_t written = 0;
+    while (written < connection.output.size())
+    {
+      ssize_t sent = ::send(connection.fd, connection.output.data() + written,
+        connection.output.size() - written, MSG_NOSIGNAL);
+      if (sent < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      {
+        break;
+      }
+      if (sent <= 0)
+      {
+        close_connection(id);
+        return;
+      }
+      written += sent;
+    }
+    connection.output.erase(0, written);
+
+    if (connection.finished && connection.pending == 0 && connection.output.empty())
+    {
+      close_connection(id);
+      return;
+    }
+    // Once finished there is nothing more to read, and the end of the
+    // input would be reported as readable forever.
+    uint32_t events = (connection.finished ? 0 : EPOLLIN | EPOLLRDHUP) | (connection.output.empty() ? 0 : EPOLLOUT);
+    if (events != connection.events)
+    {
+      connection.events = events;
+      epoll_event event{};
+      event.events = events;
+      event.data.u64 = id;
+      ::epoll_ctl(_epoll, EPOLL_CTL_MOD, connection.fd, &event);
+    }
+  }
+
+  void close_connection(uint64_t id)
+  {
+    auto found = _connections.find(id);
+    ::close(found->second.fd);
+    _connections.erase(found);
+  }
+
+  Catalog & _catalog;
+  // Solves queued or running on the pool.
+  TaskGroup _solves;
+  int _epoll = -1, _completions = -1;
+  uint64_t _next_connection;
+  std::unordered_map<uint64_t, Connection> _connections;
+  std::mutex _completed_mutex;
+  std::vector<std::pair<uint64_t, std::string>> _completed;
+};
+
+int main(int argc, char * argv[])
+{
+  std::string socket_path = argc > 1 ? argv[1] : "/tmp/maxweight.sock";
+  std::string food_path = argc > 2 ? argv[2] : "food.csv";
+
+  sigset_t signals = Daemon::shutdown_signals();
+  sigprocmask(SIG_BLOCK, &signals, nullptr);
+
+  Catalog catalog(food_path);
+  if (!catalog.holder().current())
+  {
+    return 1;
+  }
+  std::cout << "Loaded " << catalog.holder().current()->foods->size() << " foods from " << food_path << std::endl;
+  if (!catalog.holder().start_watching())
+  {
+    std::cout << "Cannot watch " << food_path << "; it won't be reloaded when it changes" << std::endl;
+  }
+
+  Daemon daemon(catalog, default_thread_pool());
+  return daemon.run(socket_path) ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+///////////////////////////////////////////////////////////////////////////////
+// maxweight_loadgen.cc
+//
+// Load generator for maxweight_daemon. Each thread opens its own
+// connection and sends solve requests back to back, cycling through a mix
+// of filters and calorie limits, then the throughput and latency
+// percentiles over all requests are printed.
+//
+// Usage: maxweight_loadgen [socket_path] [threads] [requests_per_thread]
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "maxweight_client.hh"
+#include "timer.hh"
+
+using namespace std;
+
+int main(int argc, char * argv[])
+{
+  string socket_path = argc > 1 ? argv[1] : "/tmp/maxweight.sock";
+  int threads = argc > 2 ? stoi(argv[2]) : 4;
+  int requests = argc > 3 ? stoi(argv[3]) : 1000;
+
+  vector<vector<double>> latencies(threads);
+  vector<int> failures(threads, 0);
+
+  Timer total;
+  vector<thread> workers;
+  for (int t = 0; t < threads; t++)
+  {
+    workers.emplace_back([&, t]()
+    {
+      MaxWeightClient client(socket_path);
+      for (int i = 0; i < requests; i++)
+      {
+        int variant = (t * requests + i) % 64;
+        Timer timer;
+        auto solution = client.solve(1, 2500, 50 + 25 * (variant % 8), 500 + 250 * (variant / 8));
+        latencies[t].push_back(timer.elapsed());
+        if (!solution)
+        {
+          failures[t]++;
+        }
+      }
+    });
+  }
+  for (auto & worker : workers)
+  {
+    worker.join();
+  }
+  double seconds = total.elapsed();
+
+  vector<double> all;
+  int failed = 0;
+  for (int t = 0; t < threads; t++)
+  {
+    all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+    failed += failures[t];
+  }
+  sort(all.begin(), all.end());
+  auto percentile = [&](double p)
+  {
+    return all.empty() ? 0.0 : all[min(all.size() - 1, size_t(p * all.size()))];
+  };
+
+  cout << fixed << setprecision(6)
+    << "requests: " << all.size() << " (" << failed << " failed)" << endl
+    << "seconds: " << seconds << endl
+    << "requests/second: " << all.size() / seconds << endl
+    << "latency p50: " << percentile(0.50) << endl
+    << "latency p99: " << percentile(0.99) << endl
+    << "latency max: " << percentile(1.0) << endl;
+  return failed == 0 ? 0 : 1;
+}
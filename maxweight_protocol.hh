@@ -0,0 +1,224 @@
+///////////////////////////////////////////////////////////////////////////////
+// maxweight_protocol.hh
+//
+// Wire format spoken between maxweight_daemon and MaxWeightClient over a
+// Unix domain socket.
+//
+// Every message is a frame: a 4-byte payload length followed by the
+// payload. Numbers are in host byte order, since both ends are on the same
+// machine.
+//
+// Request payload:
+//   uint32 request_id    echoed back in the response
+//   uint8  op            FILTER or SOLVE
+//   uint8  solver        DYNAMIC or EXHAUSTIVE (SOLVE only)
+//   double min_weight    arguments of filter_food_vector on the catalog
+//   double max_weight
+//   int32  total_size
+//   double total_calorie calorie limit (SOLVE only)
+//
+// Response payload:
+//   uint32 request_id
+//   uint8  status        OK or ERROR
+//   OK:    uint32 count, then count items of
+//            uint32 catalog_index, uint32 item_id (FoodItem::id()),
+//            double calories, double weight,
+//            uint16 description length, description bytes
+//   ERROR: uint16 message length, message bytes
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace maxweight_protocol {
+
+enum Op : uint8_t { FILTER = 1, SOLVE = 2 };
+enum Solver : uint8_t { DYNAMIC = 0, EXHAUSTIVE = 1 };
+enum Status : uint8_t { OK = 0, ERROR = 1 };
+
+// Frames larger than this are rejected as corrupt.
+const uint32_t MAX_FRAME_BYTES = 64 << 20;
+
+struct Request {
+  uint32_t request_id = 0;
+  Op op = SOLVE;
+  Solver solver = DYNAMIC;
+  double min_weight = 0, max_weight = 0;
+  int32_t total_size = 0;
+  double total_calorie = 0;
+};
+
+struct ResponseItem {
+  uint32_t catalog_index;
+  uint32_t item_id;
+  double calories, weight;
+  std::string description;
+};
+
+struct Response {
+  uint32_t request_id = 0;
+  Status status = OK;
+  std::vector<ResponseItem> items;
+  std::string error;
+};
+
+// Appends values to a payload.
+class Writer {
+public:
+  template <typename T>
+  void put(T value) {
+    const char * bytes = reinterpret_cast<const char *>(&value);
+    _payload.append(bytes, sizeof(T));
+  }
+
+  void put_string(const std::string & value) {
+    uint16_t size = value.size() > 0xffff ? 0xffff : value.size();
+    put(size);
+    _payload.append(value.data(), size);
+  }
+
+  // The payload with its length prefix, ready to send.
+  std::string frame() const {
+    std::string result;
+    uint32_t size = _payload.size();
+    result.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    result += _payload;
+    return result;
+  }
+
+private:
+  std::string _payload;
+};
+
+// Reads values back out of a payload. Reading past the end sets a flag
+// instead of failing, so decoders check ok() once at the end.
+class Reader {
+public:
+  Reader(const char * data, size_t size)
+  : _data(data), _size(size), _offset(0), _ok(true) { }
+
+  template <typename T>
+  T get() {
+    T value{};
+    if (_offset + sizeof(T) > _size) {
+      _ok = false;
+      return value;
+    }
+    std::memcpy(&value, _data + _offset, sizeof(T));
+    _offset += sizeof(T);
+    return value;
+  }
+
+  std::string get_string() {
+    uint16_t size = get<uint16_t>();
+    if (!_ok || _offset + size > _size) {
+      _ok = false;
+      return std::string();
+    }
+    std::string value(_data + _offset, size);
+    _offset += size;
+    return value;
+  }
+
+  bool ok() const {
+    return _ok;
+  }
+
+  bool at_end() const {
+    return _offset == _size;
+  }
+
+private:
+  const char * _data;
+  size_t _size, _offset;
+  bool _ok;
+};
+
+std::string encode_request(const Request & request) {
+  Writer writer;
+  writer.put(request.request_id);
+  writer.put<uint8_t>(request.op);
+  writer.put<uint8_t>(request.solver);
+  writer.put(request.min_weight);
+  writer.put(request.max_weight);
+  writer.put(request.total_size);
+  writer.put(request.total_calorie);
+  return writer.frame();
+}
+
+// Decode a request payload (without its length prefix). Returns false if it
+// is malformed.
+bool decode_request(const char * data, size_t size, Request & request) {
+  Reader reader(data, size);
+  request.request_id = reader.get<uint32_t>();
+  uint8_t op = reader.get<uint8_t>(), solver = reader.get<uint8_t>();
+  request.min_weight = reader.get<double>();
+  request.max_weight = reader.get<double>();
+  request.total_size = reader.get<int32_t>();
+  request.total_calorie = reader.get<double>();
+  if (!reader.ok() || !reader.at_end() || (op != FILTER && op != SOLVE) || (solver != DYNAMIC && solver != EXHAUSTIVE)) {
+    return false;
+  }
+  request.op = static_cast<Op>(op);
+  request.solver = static_cast<Solver>(solver);
+  return true;
+}
+
+std::string encode_response(const Response & response) {
+  Writer writer;
+  writer.put(response.request_id);
+  writer.put<uint8_t>(response.status);
+  if (response.status == OK) {
+    writer.put<uint32_t>(response.items.size());
+    for (auto & item: response.items) {
+      writer.put(item.catalog_index);
+      writer.put(item.item_id);
+      writer.put(item.calories);
+      writer.put(item.weight);
+      writer.put_string(item.description);
+    }
+  } else {
+    writer.put_string(response.error);
+  }
+  return writer.frame();
+}
+
+// Decode a response payload (without its length prefix). Returns false if
+// it is malformed.
+bool decode_response(const char * data, size_t size, Response & response) {
+  Reader reader(data, size);
+  response.request_id = reader.get<uint32_t>();
+  uint8_t status = reader.get<uint8_t>();
+  response.items.clear();
+  response.error.clear();
+  if (status == OK) {
+    response.status = OK;
+    uint32_t count = reader.get<uint32_t>();
+    for (uint32_t i = 0; i < count && reader.ok(); i++) {
+      ResponseItem item;
+      item.catalog_index = reader.get<uint32_t>();
+      item.item_id = reader.get<uint32_t>();
+      item.calories = reader.get<double>();
+      item.weight = reader.get<double>();
+      item.description = reader.get_string();
+      response.items.push_back(item);
+    }
+  } else if (status == ERROR) {
+    response.status = ERROR;
+    response.error = reader.get_string();
+  } else {
+    return false;
+  }
+  return reader.ok() && reader.at_end();
+}
+
+} // namespace maxweight_protocol
+
+///////////////////////////////////////////////////////////////////////////////
+// maxweight_protocol.hh
+///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,158 @@
+///////////////////////////////////////////////////////////////////////////////
+// maxweight_queuebench.cc
+//
+// Microbenchmark for MpmcQueue under contention. For each mix of producer
+// and consumer threads, producers push batches of item indices through a
+// small queue as fast as they can and consumers pop them, and the
+// operations per second are printed for the spinning and blocking wait
+// strategies and, for comparison, a mutex and condition variable queue.
+//
+// Usage: maxweight_queuebench [batches_per_producer]
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mpmcqueue.hh"
+#include "timer.hh"
+
+using namespace std;
+
+// A batch of consecutive item indices, as the pipeline stages pass around.
+struct IndexBatch
+{
+  uint32_t first, count;
+};
+
+// The baseline: one mutex around a deque.
+class LockedQueue
+{
+public:
+  explicit LockedQueue(size_t capacity) : _capacity(capacity), _closed(false) { }
+
+  bool push(IndexBatch value)
+  {
+    unique_lock<mutex> lock(_mutex);
+    _not_full.wait(lock, [&]() { return _closed || _values.size() < _capacity; });
+    if (_closed)
+    {
+      return false;
+    }
+    _values.push_back(value);
+    _not_empty.notify_one();
+    return true;
+  }
+
+  bool pop(IndexBatch & value)
+  {
+    unique_lock<mutex> lock(_mutex);
+    _not_empty.wait(lock, [&]() { return _closed || !_values.empty(); });
+    if (_values.empty())
+    {
+      return false;
+    }
+    value = _values.front();
+    _values.pop_front();
+    _not_full.notify_one();
+    return true;
+  }
+
+  void close()
+  {
+    lock_guard<mutex> lock(_mutex);
+    _closed = true;
+    _not_full.notify_all();
+    _not_empty.notify_all();
+  }
+
+private:
+  size_t _capacity;
+  bool _closed;
+  deque<IndexBatch> _values;
+  mutex _mutex;
+  condition_variable _not_full, _not_empty;
+};
+
+// Push batches_per_producer batches from each producer through queue and
+// return the pushes plus pops per second.
+template <typename Queue>
+double run(Queue & queue, int producers, int consumers, int batches_per_producer)
+{
+  atomic<uint64_t> popped_items(0);
+  atomic<int> producers_left(producers);
+
+  Timer timer;
+  vector<thread> threads;
+  for (int p = 0; p < producers; p++)
+  {
+    threads.emplace_back([&, p]()
+    {
+      for (int i = 0; i < batches_per_producer; i++)
+      {
+        queue.push(IndexBatch{uint32_t(p * batches_per_producer + i) * 64, 64});
+      }
+      if (--producers_left == 0)
+      {
+        queue.close();
+      }
+    });
+  }
+  for (int c = 0; c < consumers; c++)
+  {
+    threads.emplace_back([&]()
+    {
+      uint64_t items = 0;
+      for (IndexBatch batch; queue.pop(batch);)
+      {
+        items += batch.count;
+      }
+      popped_items += items;
+    });
+  }
+  for (auto & t : threads)
+  {
+    t.join();
+  }
+  double seconds = timer.elapsed();
+
+  uint64_t expected = uint64_t(producers) * batches_per_producer * 64;
+  if (popped_items != expected)
+  {
+    cerr << "lost batches: popped " << popped_items << " of " << expected << " items" << endl;
+  }
+  return 2.0 * producers * batches_per_producer / seconds;
+}
+
+int main(int argc, char * argv[])
+{
+  int batches = argc > 1 ? stoi(argv[1]) : 200000;
+  const size_t capacity = 64;
+
+  cout << "hardware threads: " << thread::hardware_concurrency() << endl;
+  cout << setw(10) << "producers" << setw(10) << "consumers"
+    << setw(14) << "spin ops/s" << setw(14) << "block ops/s" << setw(14) << "mutex ops/s" << endl;
+  cout << fixed << setprecision(0);
+
+  for (int producers : {1, 2, 4})
+  {
+    for (int consumers : {1, 2, 4})
+    {
+      MpmcQueue<IndexBatch> spinning(capacity, QueueWait::SPIN), blocking(capacity, QueueWait::BLOCK);
+      LockedQueue locked(capacity);
+      double spin = run(spinning, producers, consumers, batches);
+      double block = run(blocking, producers, consumers, batches);
+      double mutex = run(locked, producers, consumers, batches);
+      cout << setw(10) << producers << setw(10) << consumers
+        << setw(14) << spin << setw(14) << block << setw(14) << mutex << endl;
+    }
+  }
+  return 0;
+}
@@ -2,14 +2,106 @@
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <string>
 
+#include "groupsolve.hh"
 #include "maxweight.hh"
+#include "pipeline.hh"
 #include "timer.hh"
 
 using namespace std;
 
-int main()
+// Time parallel_dynamic_max_weight on wide tables and write parallel.csv.
+// With numa, workers are pinned with numa_worker_cpus() and each one
+// first-touches its own partition; without, neither happens.
+void parallel_scatterplot(const FoodVector & filtered_foods, bool numa)
 {
+  if (numa)
+  {
+    default_thread_pool_settings().cpus = numa_worker_cpus();
+  }
+
+  ofstream parallel("parallel.csv");
+  parallel << "n,seconds" << endl;
+  parallel << fixed << setprecision(10);
+
+  for (int n = 100; n <= 2000; n += 100)
+  {
+    auto small_foods = filter_food_vector(filtered_foods, 1, 2000, n);
+
+    Timer timer;
+    auto solution = parallel_dynamic_max_weight(*small_foods, 200000, default_thread_pool(), numa);
+    parallel << n << "," << timer.elapsed() << endl;
+  }
+  parallel.close();
+}
+
+// Time the sequential load, filter and solve against the pipelined one for
+// growing calorie limits, and print the throughput of each pipeline stage.
+void pipelined_comparison()
+{
+  cout << fixed << setprecision(6);
+  for (double limit = 2000; limit <= 32000; limit *= 2)
+  {
+    Timer timer;
+    auto all_foods = load_food_database("food.csv");
+    auto filtered_foods = filter_food_vector(*all_foods, 1, 2500, all_foods->size());
+    auto solution = dynamic_max_weight(*filtered_foods, limit);
+    double sequential = timer.elapsed();
+
+    PipelineStats stats;
+    auto pipelined = pipelined_dynamic_max_weight("food.csv", 1, 2500, all_foods->size(), limit, default_thread_pool(), 512, &stats);
+    cout << "limit " << int(limit) << ": sequential " << sequential << " s, pipelined " << stats.seconds << " s" << endl;
+    for (auto & stage : stats.stages)
+    {
+      cout << "  " << setw(6) << stage.name << ": " << stage.rows << " rows, "
+        << stage.rows_per_second() << " rows/s busy" << endl;
+    }
+  }
+}
+
+// Time grouped_dynamic_max_weight against dynamic_max_weight on the whole
+// catalog, for growing numbers of groups.
+void grouped_comparison(const FoodVector & filtered_foods)
+{
+  cout << fixed << setprecision(6);
+  Timer timer;
+  auto solution = dynamic_max_weight(filtered_foods, 2000);
+  cout << "dynamic: " << timer.elapsed() << " s" << endl;
+  for (size_t groups = 1; groups <= 4 * default_thread_pool().size(); groups *= 2)
+  {
+    Timer grouped_timer;
+    auto grouped = grouped_dynamic_max_weight(filtered_foods, 2000, groups);
+    cout << groups << " groups: " << grouped_timer.elapsed() << " s" << endl;
+  }
+}
+
+// Usage: maxweight_scatterplot [--parallel [--no-numa] | --pipelined | --grouped]
+int main(int argc, char * argv[])
+{
+  if (argc > 1 && string(argv[1]) == "--pipelined")
+  {
+    pipelined_comparison();
+    return 0;
+  }
+
+  if (argc > 1 && string(argv[1]) == "--grouped")
+  {
+    auto all_foods = load_food_database("food.csv");
+    auto filtered_foods = filter_food_vector(*all_foods, 1, 2500, all_foods->size());
+    grouped_comparison(*filtered_foods);
+    return 0;
+  }
+
+  if (argc > 1 && string(argv[1]) == "--parallel")
+  {
+    auto all_foods = load_food_database("food.csv");
+    auto filtered_foods = filter_food_vector(*all_foods, 1, 2500, all_foods->size());
+    bool numa = !(argc > 2 && string(argv[2]) == "--no-numa");
+    parallel_scatterplot(*filtered_foods, numa);
+    return 0;
+  }
+
   ofstream exhaustive("exhaustive.csv");
   exhaustive << "n,seconds" << endl;
   exhaustive << fixed << setprecision(10);
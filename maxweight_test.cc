@@ -7,11 +7,27 @@
 
 
 #include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <sstream>
+#include <thread>
 
 
+#include "asyncsolve.hh"
+#include "bucketsolve.hh"
+#include "catalog.hh"
+#include "groupsolve.hh"
+#include "intervalsolve.hh"
 #include "maxweight.hh"
+#include "maxweight_protocol.hh"
+#include "mpmcqueue.hh"
+#include "outofcore.hh"
+#include "pipeline.hh"
 #include "rubrictest.hh"
+#include "sensitivity.hh"
+#include "solvercache.hh"
+#include "streaming.hh"
 
 
 int main()
@@ -206,6 +222,942 @@ int main()
 		}
 	);
 
+	//
+	rubric.criterion(
+		"exhaustive_max_weight_table matches exhaustive_max_weight", 2,
+		[&]()
+		{
+			auto soln = exhaustive_max_weight_table(trivial_foods, 14);
+			TEST_TRUE("non-null", soln);
+			TEST_EQUAL("whole corn and pasta", 2, soln->size());
+			TEST_TRUE("empty solution", exhaustive_max_weight_table(trivial_foods, 3)->empty());
+			
+			ThreadPool pool(3);
+			for (int n = 1; n <= 18; n++)
+			{
+				auto small_foods = filter_food_vector(*filtered_foods, 1, 2000, n);
+				auto expected = exhaustive_max_weight(*small_foods, 2000);
+				auto actual = exhaustive_max_weight_table(*small_foods, 2000, pool);
+				TEST_EQUAL("same subset size", expected->size(), actual->size());
+				for (size_t i = 0; i < expected->size(); i++) {
+					TEST_EQUAL("same subset", (*expected)[i], (*actual)[i]);
+				}
+			}
+		}
+	);
+
+	//
+	rubric.criterion(
+		"batch_max_weight matches dynamic_max_weight", 2,
+		[&]()
+		{
+			std::vector<std::unique_ptr<FoodVector>> inputs;
+			std::vector<DynamicJob> jobs;
+			for (int n = 1; n <= 40; n++)
+			{
+				inputs.push_back(filter_food_vector(*filtered_foods, 1, 2000, n * 5));
+				jobs.push_back(DynamicJob{inputs.back().get(), 100.0 * (n % 7 + 1)});
+			}
+			jobs.push_back(DynamicJob{&trivial_foods, 14});
+			
+			ThreadPool pool(4);
+			auto results = batch_max_weight(jobs, pool);
+			TEST_EQUAL("one result per job", jobs.size(), results.size());
+			for (size_t i = 0; i < jobs.size(); i++)
+			{
+				auto expected = dynamic_max_weight(*jobs[i].foods, jobs[i].total_calorie);
+				TEST_TRUE("non-null", results[i]);
+				TEST_EQUAL("same solution size", expected->size(), results[i]->size());
+				for (size_t j = 0; j < expected->size(); j++) {
+					TEST_EQUAL("same solution", (*expected)[j], (*results[i])[j]);
+				}
+			}
+		}
+	);
+
+	//
+	rubric.criterion(
+		"parallel_dynamic_max_weight matches dynamic_max_weight", 2,
+		[&]()
+		{
+			ThreadPool pool(4, numa_worker_cpus(4));
+			TEST_TRUE("empty solution", parallel_dynamic_max_weight(trivial_foods, 3, pool)->empty());
+			
+			auto foods = filter_food_vector(*filtered_foods, 1, 2500, 150);
+			for (double limit : {10.0, 2000.0, 30000.0})
+			{
+				auto expected = dynamic_max_weight(*foods, limit);
+				for (bool first_touch : {true, false})
+				{
+					for (bool steal : {false, true})
+					{
+						auto actual = parallel_dynamic_max_weight(*foods, limit, pool, first_touch, steal);
+						TEST_EQUAL("same solution size", expected->size(), actual->size());
+						for (size_t i = 0; i < expected->size(); i++) {
+							TEST_EQUAL("same solution", (*expected)[i], (*actual)[i]);
+						}
+					}
+				}
+			}
+			
+			// A stealable task queued on a blocked worker still runs.
+			std::atomic<bool> release(false), ran(false);
+			pool.submit_to(0, [&]() {
+				while (!release) {
+					std::this_thread::yield();
+				}
+			});
+			TaskGroup group(pool);
+			group.run_on(0, [&]() { ran = true; }, true);
+			group.wait();
+			TEST_TRUE("stolen from a blocked worker", ran);
+			release = true;
+		}
+	);
+
+	//
+	rubric.criterion(
+		"SolverCache hits, misses and evictions", 2,
+		[&]()
+		{
+			auto foods = filter_food_vector(*filtered_foods, 1, 2500, 60);
+			auto copy = std::make_unique<FoodVector>(*foods);
+			SolverCache cache(1 << 20);
+			
+			auto expected = dynamic_max_weight(*foods, 1500);
+			auto first = cache.dynamic_max_weight(*foods, 1500);
+			auto second = cache.dynamic_max_weight(*copy, 1500);
+			TEST_EQUAL("one miss", 1, cache.stats().misses);
+			TEST_EQUAL("one hit", 1, cache.stats().hits);
+			TEST_EQUAL("same solution size", expected->size(), first->size());
+			TEST_EQUAL("same solution size", expected->size(), second->size());
+			for (size_t i = 0; i < expected->size(); i++) {
+				TEST_EQUAL("same solution", (*expected)[i], (*first)[i]);
+				TEST_EQUAL("same solution", (*expected)[i], (*second)[i]);
+			}
+			
+			cache.dynamic_max_weight(*foods, 1000);
+			cache.dynamic_max_weight(trivial_foods, 1500);
+			TEST_EQUAL("different limit or foods miss", 3, cache.stats().misses);
+			TEST_EQUAL("three entries", 3, cache.stats().entries);
+			
+			SolverCache tiny(1);
+			tiny.dynamic_max_weight(trivial_foods, 14);
+			tiny.dynamic_max_weight(trivial_foods, 14);
+			TEST_EQUAL("evicted", 2, tiny.stats().evictions);
+			TEST_EQUAL("nothing kept", 0, tiny.stats().bytes);
+		}
+	);
+
+	//
+	rubric.criterion(
+		"SolverCache answers smaller limits from a kept table", 2,
+		[&]()
+		{
+			auto foods = filter_food_vector(*filtered_foods, 1, 2500, 80);
+			SolverCache cache(1 << 20, 16 << 20);
+			
+			cache.dynamic_max_weight(*foods, 3000);
+			TEST_EQUAL("one table kept", 1, cache.stats().tables);
+			for (double limit : {2999.0, 1500.0, 700.5, 0.0})
+			{
+				auto expected = dynamic_max_weight(*foods, limit);
+				auto actual = cache.dynamic_max_weight(*foods, limit);
+				TEST_EQUAL("same solution size", expected->size(), actual->size());
+				for (size_t i = 0; i < expected->size(); i++) {
+					TEST_EQUAL("same solution", (*expected)[i], (*actual)[i]);
+				}
+				double calories, weight;
+				sum_food_vector(*expected, calories, weight);
+				TEST_EQUAL("max weight", std::round(weight * 100), std::round(cache.max_weight(*foods, limit) * 100));
+			}
+			TEST_EQUAL("answered from the table", 8, cache.stats().table_hits);
+			
+			cache.dynamic_max_weight(*foods, 4000);
+			TEST_EQUAL("wider table replaces narrower", 1, cache.stats().tables);
+		}
+	);
+
+	//
+	rubric.criterion(
+		"daemon protocol round trip", 1,
+		[&]()
+		{
+			maxweight_protocol::Request request, decoded_request;
+			request.request_id = 7;
+			request.solver = maxweight_protocol::EXHAUSTIVE;
+			request.min_weight = 1;
+			request.max_weight = 2500;
+			request.total_size = 20;
+			request.total_calorie = 2000;
+			std::string frame = maxweight_protocol::encode_request(request);
+			TEST_TRUE("decodes", maxweight_protocol::decode_request(frame.data() + 4, frame.size() - 4, decoded_request));
+			TEST_EQUAL("request id", 7, decoded_request.request_id);
+			TEST_EQUAL("solver", maxweight_protocol::EXHAUSTIVE, decoded_request.solver);
+			TEST_EQUAL("total calorie", 2000, decoded_request.total_calorie);
+			TEST_FALSE("truncated", maxweight_protocol::decode_request(frame.data() + 4, frame.size() - 5, decoded_request));
+			
+			maxweight_protocol::Response response, decoded_response;
+			response.request_id = 7;
+			response.items.push_back(maxweight_protocol::ResponseItem{3, 0x9e3779b9, 83, 551.95, "Idaho potatoes"});
+			frame = maxweight_protocol::encode_response(response);
+			TEST_TRUE("decodes", maxweight_protocol::decode_response(frame.data() + 4, frame.size() - 4, decoded_response));
+			TEST_EQUAL("one item", 1, decoded_response.items.size());
+			TEST_EQUAL("description", "Idaho potatoes", decoded_response.items[0].description);
+			TEST_EQUAL("weight", 551.95, decoded_response.items[0].weight);
+		}
+	);
+
+	//
+	rubric.criterion(
+		"CatalogHolder reloads without disturbing readers", 2,
+		[&]()
+		{
+			const std::string path = "/tmp/maxweight_test_catalog.csv";
+			auto write_catalog = [&](int rows)
+			{
+				std::ofstream out(path + ".new");
+				out << "Item^Calories^Weight" << std::endl;
+				for (int i = 0; i < rows; i++) {
+					out << "test food " << i << "^" << 10 + i << "^" << 100 + i << std::endl;
+				}
+				out.close();
+				std::rename((path + ".new").c_str(), path.c_str());
+			};
+			
+			write_catalog(3);
+			CatalogHolder catalog(path);
+			auto first = catalog.current();
+			TEST_TRUE("loaded", first);
+			TEST_EQUAL("version", 1, first->version);
+			TEST_EQUAL("size", 3, first->foods->size());
+			
+			write_catalog(5);
+			TEST_TRUE("reload", catalog.reload());
+			TEST_EQUAL("new version", 5, catalog.current()->foods->size());
+			TEST_EQUAL("old version still intact", 3, first->foods->size());
+			TEST_EQUAL("positions", 2, first->positions.at((*first->foods)[2]->id()));
+			
+			// Change row 1, drop row 3, add rows 5 and 6.
+			{
+				std::ofstream out(path);
+				out << "Item^Calories^Weight" << std::endl
+					<< "test food 0^10^100" << std::endl
+					<< "test food 1^11^999" << std::endl
+					<< "test food 2^12^102" << std::endl
+					<< "test food 4^14^104" << std::endl
+					<< "test food 5^15^105" << std::endl
+					<< "test food 6^16^106" << std::endl;
+			}
+			auto before = catalog.current();
+			size_t notified = 0;
+			catalog.on_reload([&](const CatalogSnapshot & previous, const CatalogSnapshot & current, const FoodRowDelta &)
+			{
+				notified += previous.version == before->version && current.version == before->version + 1;
+			});
+			FoodRowDelta delta;
+			TEST_TRUE("incremental reload", catalog.reload_incremental(&delta));
+			TEST_EQUAL("listener", 1, notified);
+			auto after = catalog.current();
+			TEST_EQUAL("unchanged", 3, delta.unchanged);
+			TEST_EQUAL("updated", 1, delta.updated.size());
+			TEST_EQUAL("updated row", 1, delta.updated[0].first);
+			TEST_EQUAL("added", 2, delta.added.size());
+			TEST_EQUAL("added row", 4, delta.added[0]);
+			TEST_EQUAL("removed", 1, delta.removed.size());
+			TEST_EQUAL("removed row", 3, delta.removed[0]);
+			TEST_EQUAL("unchanged items shared", (*before->foods)[4], (*after->foods)[3]);
+			TEST_EQUAL("updated weight", 999, (*after->foods)[1]->weight());
+			TEST_FALSE("order kept", delta.reordered);
+			TEST_EQUAL("patched positions", after->foods->size(), after->positions.size());
+			for (size_t i = 0; i < after->foods->size(); i++) {
+				TEST_EQUAL("patched position", i, after->positions.at((*after->foods)[i]->id()));
+			}
+			
+			// Swap rows 0 and 2.
+			{
+				std::ofstream out(path);
+				out << "Item^Calories^Weight" << std::endl
+					<< "test food 2^12^102" << std::endl
+					<< "test food 1^11^999" << std::endl
+					<< "test food 0^10^100" << std::endl;
+			}
+			FoodRowDelta swapped;
+			TEST_TRUE("reordering reload", catalog.reload_incremental(&swapped));
+			TEST_TRUE("reordered", swapped.reordered);
+			TEST_EQUAL("moved position", 2, catalog.current()->positions.at((*after->foods)[0]->id()));
+			catalog.on_reload(nullptr);
+			
+			TEST_TRUE("watching", catalog.start_watching());
+			write_catalog(7);
+			for (int i = 0; i < 200 && catalog.current()->foods->size() != 7; i++) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+			TEST_EQUAL("reloaded on change", 7, catalog.current()->foods->size());
+			catalog.stop_watching();
+			std::remove(path.c_str());
+		}
+	);
+
+	//
+	rubric.criterion(
+		"spilled_dynamic_max_weight matches dynamic_max_weight", 2,
+		[&]()
+		{
+			TEST_TRUE("empty solution", spilled_dynamic_max_weight(trivial_foods, 3)->empty());
+			TEST_TRUE("no scratch directory", !spilled_dynamic_max_weight(trivial_foods, 3, "/nonexistent"));
+			
+			for (double limit : {500.0, 5000.0})
+			{
+				auto expected = dynamic_max_weight(*filtered_foods, limit);
+				auto actual = spilled_dynamic_max_weight(*filtered_foods, limit);
+				TEST_TRUE("non-null", actual);
+				TEST_EQUAL("same solution size", expected->size(), actual->size());
+				for (size_t i = 0; i < expected->size(); i++) {
+					TEST_EQUAL("same solution", (*expected)[i], (*actual)[i]);
+				}
+			}
+		}
+	);
+
+	//
+	rubric.criterion(
+		"checkpointed_dynamic_max_weight resumes and matches dynamic_max_weight", 2,
+		[&]()
+		{
+			const std::string path = "/tmp/maxweight_test.checkpoint";
+			std::remove(path.c_str());
+			auto foods = filter_food_vector(*filtered_foods, 1, 2500, 500);
+			auto expected = dynamic_max_weight(*foods, 2000);
+			
+			std::atomic<bool> interrupted(true);
+			TEST_TRUE("interrupted", !checkpointed_dynamic_max_weight(*foods, 2000, path, 0, &interrupted));
+			std::ifstream partial(path, std::ios::binary | std::ios::ate);
+			TEST_TRUE("checkpoint kept", partial.is_open() && partial.tellg() > 0);
+			partial.close();
+			
+			auto actual = checkpointed_dynamic_max_weight(*foods, 2000, path);
+			TEST_TRUE("non-null", actual);
+			TEST_EQUAL("same solution size", expected->size(), actual->size());
+			for (size_t i = 0; i < expected->size(); i++) {
+				TEST_EQUAL("same solution", (*expected)[i], (*actual)[i]);
+			}
+			TEST_FALSE("checkpoint removed", std::ifstream(path).is_open());
+			
+			auto small = checkpointed_dynamic_max_weight(trivial_foods, 9, path, 1);
+			TEST_EQUAL("pasta only", 1, small->size());
+			TEST_EQUAL("pasta only", "test pasta", (*small)[0]->description());
+		}
+	);
+
+	//
+	rubric.criterion(
+		"streaming_dynamic_max_weight matches dynamic_max_weight", 2,
+		[&]()
+		{
+			auto foods = filter_food_vector(*all_foods, 1, 2500, 500);
+			auto expected = dynamic_max_weight(*foods, 2000);
+			auto actual = streaming_dynamic_max_weight("food.csv", 1, 2500, 500, 2000);
+			TEST_TRUE("non-null", actual);
+			TEST_EQUAL("same solution size", expected->size(), actual->size());
+			for (size_t i = 0; i < expected->size(); i++) {
+				TEST_EQUAL("same description", (*expected)[i]->description(), (*actual)[i]->description());
+				TEST_EQUAL("same calories", (*expected)[i]->calorie(), (*actual)[i]->calorie());
+				TEST_EQUAL("same weight", (*expected)[i]->weight(), (*actual)[i]->weight());
+			}
+			
+			StreamingDynamicSolver solver(9);
+			for (auto & food : trivial_foods) {
+				solver.add(food->calorie(), food->weight());
+			}
+			TEST_EQUAL("pasta only", 1, solver.selection().size());
+			TEST_EQUAL("pasta only", 1, solver.selection()[0]);
+			TEST_EQUAL("pasta weight", 5.0, solver.max_weight());
+			
+			// A chosen row rewritten in place between the passes, to a line
+			// of the same length that still parses, is caught.
+			const std::string path = "/tmp/maxweight_test_streaming.csv";
+			const std::string header = "Item^Calories^Weight\n", row = "test streamed beans^5^10\n";
+			{
+				std::ofstream out(path, std::ios::binary);
+				out << header << row;
+			}
+			StreamingDynamicSolver first_pass(9);
+			StreamedRows rows;
+			TEST_TRUE("first pass", stream_food_rows(path, 1, 2500, 10, first_pass, rows));
+			TEST_EQUAL("chosen", 1, first_pass.selection().size());
+			TEST_TRUE("unchanged", read_streamed_rows(path, rows, first_pass.selection()));
+			{
+				std::fstream out(path, std::ios::binary | std::ios::in | std::ios::out);
+				out.seekp(header.size());
+				out << "test streamed bread^5^99";
+			}
+			TEST_FALSE("rewritten in place", read_streamed_rows(path, rows, first_pass.selection()));
+			std::remove(path.c_str());
+		}
+	);
+
+	//
+	rubric.criterion(
+		"pipelined_dynamic_max_weight matches dynamic_max_weight", 2,
+		[&]()
+		{
+			ThreadPool pool(3);
+			for (int size : {500, int(all_foods->size())}) {
+				auto foods = filter_food_vector(*all_foods, 1, 2500, size);
+				auto expected = dynamic_max_weight(*foods, 1000);
+				PipelineStats stats;
+				auto actual = pipelined_dynamic_max_weight("food.csv", 1, 2500, size, 1000, pool, 100, &stats);
+				TEST_TRUE("non-null", actual);
+				TEST_EQUAL("same solution size", expected->size(), actual->size());
+				for (size_t i = 0; i < expected->size(); i++) {
+					TEST_EQUAL("same description", (*expected)[i]->description(), (*actual)[i]->description());
+					TEST_EQUAL("same weight", (*expected)[i]->weight(), (*actual)[i]->weight());
+				}
+				TEST_EQUAL("four stages", 4, stats.stages.size());
+				TEST_EQUAL("solved rows", foods->size(), stats.stages[3].rows);
+			}
+			// From one of the pool's own workers, which helps parse while the
+			// reader waits.
+			ThreadPool single(1);
+			std::unique_ptr<FoodVector> nested;
+			TaskGroup group(single);
+			group.run_on(0, [&]() {
+				nested = pipelined_dynamic_max_weight("food.csv", 1, 2500, 500, 1000, single, 16);
+			});
+			group.wait();
+			TEST_TRUE("nested non-null", nested);
+			TEST_EQUAL("nested solution size", dynamic_max_weight(*filter_food_vector(*all_foods, 1, 2500, 500), 1000)->size(), nested->size());
+			TEST_FALSE("missing file", pipelined_dynamic_max_weight("/nonexistent.csv", 1, 2500, 10, 100));
+		}
+	);
+
+	//
+	rubric.criterion(
+		"MpmcQueue delivers every value once", 2,
+		[&]()
+		{
+			for (QueueWait wait : {QueueWait::SPIN, QueueWait::BLOCK}) {
+				MpmcQueue<uint64_t> queue(8, wait);
+				const uint64_t per_producer = 20000;
+				std::atomic<uint64_t> sum(0), count(0);
+				std::atomic<int> producers_left(3);
+				std::vector<std::thread> threads;
+				for (int p = 0; p < 3; p++) {
+					threads.emplace_back([&, p]() {
+						for (uint64_t i = 1; i <= per_producer; i++) {
+							queue.push(p * per_producer + i);
+						}
+						if (--producers_left == 0) {
+							queue.close();
+						}
+					});
+				}
+				for (int c = 0; c < 3; c++) {
+					threads.emplace_back([&]() {
+						for (uint64_t value; queue.pop(value);) {
+							sum += value;
+							count++;
+						}
+					});
+				}
+				for (auto & t : threads) {
+					t.join();
+				}
+				uint64_t n = 3 * per_producer;
+				TEST_EQUAL("count", n, count.load());
+				TEST_EQUAL("sum", n * (n + 1) / 2, sum.load());
+				TEST_FALSE("push after close", queue.push(1));
+			}
+			
+			MpmcQueue<int> small(3);
+			int value = 1;
+			for (int i = 0; i < 4; i++) {
+				TEST_TRUE("room for 4", small.try_push(value));
+			}
+			TEST_FALSE("full", small.try_push(value));
+			small.close();
+			int drained = 0;
+			while (small.pop(value)) {
+				drained++;
+			}
+			TEST_EQUAL("drained after close", 4, drained);
+		}
+	);
+
+	//
+	rubric.criterion(
+		"async_dynamic_max_weight runs on the pool and cancels", 2,
+		[&]()
+		{
+			auto foods = filter_food_vector(*filtered_foods, 1, 2500, 200);
+			auto expected_small = dynamic_max_weight(*foods, 500);
+			auto expected_large = dynamic_max_weight(*foods, 2000);
+			
+			// A coroutine awaiting several solves started at once.
+			auto solve_both = [](const FoodVector & foods) -> Task<std::pair<size_t, size_t>> {
+				auto small = async_dynamic_max_weight(foods, 500);
+				auto large = async_dynamic_max_weight(foods, 2000);
+				auto small_solution = co_await small;
+				auto large_solution = co_await large;
+				co_return std::make_pair(small_solution->size(), large_solution->size());
+			};
+			auto sizes = solve_both(*foods).get();
+			TEST_EQUAL("small", expected_small->size(), sizes.first);
+			TEST_EQUAL("large", expected_large->size(), sizes.second);
+			
+			auto solution = async_dynamic_max_weight(*foods, 2000).get();
+			TEST_EQUAL("same solution size", expected_large->size(), solution->size());
+			for (size_t i = 0; i < solution->size(); i++) {
+				TEST_EQUAL("same solution", (*expected_large)[i], (*solution)[i]);
+			}
+			
+			CancellationToken cancelled;
+			cancelled.cancel();
+			TEST_FALSE("cancelled before start", async_dynamic_max_weight(*foods, 2000, cancelled).get());
+			
+			CancellationToken token;
+			auto wide = filter_food_vector(*filtered_foods, 1, 2500, 2000);
+			auto slow = async_dynamic_max_weight(*wide, 100000, token);
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			token.cancel();
+			TEST_FALSE("cancelled while solving", slow.get());
+			
+			auto loaded = async_load_food_database("food.csv").get();
+			TEST_EQUAL("loaded", all_foods->size(), loaded->size());
+		}
+	);
+
+	//
+	rubric.criterion(
+		"load_food_database skips and reports invalid rows", 2,
+		[&]()
+		{
+			std::shared_ptr<FoodItem> item;
+			std::string reason;
+			TEST_TRUE("valid", parse_food_line("refried spicy beans^59^481.1", item, reason));
+			TEST_EQUAL("description", "refried spicy beans", item->description());
+			TEST_EQUAL("calories", 59, item->calorie());
+			TEST_EQUAL("weight", 481.1, item->weight());
+			TEST_TRUE("CRLF and spaces", parse_food_line("beans^ 59 ^-4.5\r", item, reason));
+			TEST_EQUAL("negative weight", -4.5, item->weight());
+			TEST_FALSE("field count", parse_food_line("beans^59", item, reason));
+			TEST_FALSE("item reset", item);
+			TEST_FALSE("trailing garbage", parse_food_line("beans^59x^4", item, reason));
+			TEST_FALSE("not a number", parse_food_line("beans^59^heavy", item, reason));
+			TEST_FALSE("empty field", parse_food_line("beans^^4", item, reason));
+			TEST_FALSE("zero calories", parse_food_line("beans^0^4", item, reason));
+			TEST_FALSE("empty description", parse_food_line("^59^4", item, reason));
+			TEST_FALSE("infinite", parse_food_line("beans^inf^4", item, reason));
+			
+			const std::string path = "/tmp/maxweight_test_invalid.csv";
+			{
+				std::ofstream out(path);
+				out << "Item^Calories^Weight\n"
+					<< "beans^59^481.1\n"
+					<< "corrupt row\n"
+					<< "rice^abc^20\n"
+					<< "corn^10^20^30\n"
+					<< "pasta^4^5\n";
+			}
+			FoodLoadReport report;
+			auto foods = load_food_database(path, &report);
+			std::remove(path.c_str());
+			TEST_TRUE("loaded", foods);
+			TEST_EQUAL("valid rows", 2, foods->size());
+			TEST_EQUAL("rows", 5, report.rows);
+			TEST_EQUAL("errors", 3, report.errors.size());
+			TEST_EQUAL("first error line", 3, report.errors[0].line_number);
+			TEST_EQUAL("second error line", 4, report.errors[1].line_number);
+			TEST_EQUAL("third error line", 5, report.errors[2].line_number);
+			TEST_EQUAL("last item", "pasta", (*foods)[1]->description());
+			
+			FoodLoadReport full;
+			TEST_EQUAL("food.csv", 8064, load_food_database("food.csv", &full)->size());
+			TEST_EQUAL("food.csv is clean", 0, full.errors.size());
+		}
+	);
+
+	//
+	rubric.criterion(
+		"compressed catalogs load like the plain file", 2,
+		[&]()
+		{
+			std::ifstream csv("food.csv", std::ios::binary);
+			std::string text((std::istreambuf_iterator<char>(csv)), std::istreambuf_iterator<char>());
+			auto write_file = [](const std::string & path, const std::string & bytes) {
+				std::ofstream out(path, std::ios::binary);
+				out << bytes;
+			};
+			
+			const std::string zstd_path = "/tmp/maxweight_test_food.csv.zst";
+			write_file(zstd_path, std::string("\x28\xb5\x2f\xfd", 4) + "not really zstd");
+			TEST_FALSE("corrupt or unsupported zstd", load_food_database(zstd_path));
+			std::remove(zstd_path.c_str());
+#if defined(MAXWEIGHT_USE_ZLIB)
+			auto gzip = [](const std::string & bytes) {
+				uLongf size = compressBound(bytes.size()) + 32;
+				std::string out(size, '\0');
+				z_stream stream{};
+				deflateInit2(&stream, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+				stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(bytes.data()));
+				stream.avail_in = bytes.size();
+				stream.next_out = reinterpret_cast<Bytef *>(&out[0]);
+				stream.avail_out = out.size();
+				deflate(&stream, Z_FINISH);
+				out.resize(stream.total_out);
+				deflateEnd(&stream);
+				return out;
+			};
+			const std::string path = "/tmp/maxweight_test_food.csv.gz";
+			std::string compressed = gzip(text);
+			write_file(path, compressed);
+			CatalogInputStream stream(path);
+			TEST_TRUE("detected", stream.compression() == CatalogCompression::GZIP);
+			auto foods = load_food_database(path);
+			TEST_TRUE("loaded", foods);
+			TEST_EQUAL("size", all_foods->size(), foods->size());
+			TEST_EQUAL("last item", all_foods->back()->description(), foods->back()->description());
+			
+			auto pipelined = pipelined_dynamic_max_weight(path, 1, 2500, 100, 500);
+			TEST_EQUAL("pipelined", dynamic_max_weight(*filter_food_vector(*all_foods, 1, 2500, 100), 500)->size(), pipelined->size());
+			
+			// Read on the only worker of the pool that decompresses, and
+			// quit another read early.
+			ThreadPool single(1);
+			size_t lines = 0;
+			TaskGroup group(single);
+			group.run_on(0, [&]() {
+				CatalogInputStream whole(path, &single);
+				for (std::string line; std::getline(whole, line);) {
+					lines++;
+				}
+				CatalogInputStream early(path, &single);
+				std::string line;
+				std::getline(early, line);
+			});
+			group.wait();
+			TEST_EQUAL("read on the decompressing worker", size_t(std::count(text.begin(), text.end(), '\n')), lines);
+			
+			// With a long task queued on that worker too, the reader runs
+			// the decoding itself rather than the long task.
+			std::atomic<bool> read_done(false), interrupted(false);
+			lines = 0;
+			group.run_on(0, [&]() {
+				CatalogInputStream whole(path, &single);
+				group.run_on(0, [&]() {
+					interrupted = !read_done;
+					auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+					while (!read_done && std::chrono::steady_clock::now() < deadline) {
+						std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					}
+				});
+				for (std::string line; std::getline(whole, line);) {
+					lines++;
+				}
+				read_done = true;
+			});
+			group.wait();
+			TEST_FALSE("reader ran unrelated work", interrupted);
+			TEST_EQUAL("read behind a long task", size_t(std::count(text.begin(), text.end(), '\n')), lines);
+			
+			// Two members, split mid-line.
+			size_t half = text.size() / 2;
+			write_file(path, gzip(text.substr(0, half)) + gzip(text.substr(half)));
+			TEST_EQUAL("concatenated", all_foods->size(), load_food_database(path)->size());
+			
+			write_file(path, compressed.substr(0, compressed.size() / 2));
+			TEST_FALSE("truncated", load_food_database(path));
+			std::remove(path.c_str());
+#endif
+		}
+	);
+
+	//
+	rubric.criterion(
+		"descriptions are interned once", 2,
+		[&]()
+		{
+			StringPool pool;
+			uint32_t beans = pool.intern("refried spicy beans"), rice = pool.intern("rice");
+			TEST_EQUAL("same id", beans, pool.intern(std::string("refried ") + "spicy beans"));
+			TEST_TRUE("different id", beans != rice);
+			TEST_EQUAL("text", "rice", pool.get(rice));
+			TEST_TRUE("hash", pool.hash(beans) == hash_string("refried spicy beans"));
+			TEST_EQUAL("distinct", 2, pool.size());
+			TEST_EQUAL("bytes", 23, pool.bytes());
+			// Cross a few segment boundaries.
+			for (int i = 0; i < 5000; i++) {
+				TEST_EQUAL("sequential ids", uint32_t(i + 2), pool.intern("item " + std::to_string(i)));
+			}
+			TEST_EQUAL("last", "item 4999", pool.get(5001));
+			TEST_EQUAL("first", "refried spicy beans", pool.get(beans));
+			
+			std::unordered_map<uint32_t, std::string> seen;
+			for (auto & food : *all_foods) {
+				auto inserted = seen.emplace(food->description_id(), food->description());
+				TEST_EQUAL("one description per id", inserted.first->second, food->description());
+			}
+			TEST_TRUE("deduplicated", seen.size() < all_foods->size());
+			
+			StringPool counted;
+			uint32_t kept = counted.intern("kept"), dropped = counted.intern("dropped");
+			counted.intern("dropped");
+			counted.release(dropped);
+			TEST_EQUAL("still referenced", "dropped", counted.get(dropped));
+			counted.release(dropped);
+			TEST_EQUAL("removed", 1, counted.size());
+			TEST_EQUAL("removed bytes", 4, counted.bytes());
+			TEST_TRUE("ID not reused", dropped != counted.intern("again"));
+			TEST_TRUE("new ID for the same string", dropped != counted.intern("dropped"));
+			TEST_EQUAL("others untouched", "kept", counted.get(kept));
+			
+			// Items hold their descriptions, so once the loaders are done
+			// only the selected items' are left.
+			size_t before = description_pool().size();
+			{
+				FoodItem item("test description of one item", 1, 1);
+				FoodItem copy = item;
+				TEST_EQUAL("held", before + 1, description_pool().size());
+			}
+			TEST_EQUAL("freed with the last item", before, description_pool().size());
+			
+			const std::string path = "/tmp/maxweight_test_interning.csv";
+			{
+				std::ofstream out(path);
+				out << "Item^Calories^Weight" << std::endl;
+				for (int i = 0; i < 200; i++) {
+					out << "test interned food " << i << "^" << 10 + i % 7 << "^" << (i < 20 ? 100 : 5000) << std::endl;
+				}
+			}
+			auto streamed = streaming_dynamic_max_weight(path, 1, 2500, 200, 50);
+			TEST_TRUE("streamed", streamed && !streamed->empty());
+			TEST_EQUAL("streaming keeps the selection interned", before + streamed->size(), description_pool().size());
+			streamed.reset();
+			ThreadPool workers(2);
+			std::unique_ptr<FoodVector> pipelined(pipelined_dynamic_max_weight(path, 1, 2500, 200, 50, workers, 16));
+			TEST_TRUE("pipelined", pipelined && !pipelined->empty());
+			TEST_EQUAL("pipelined keeps the selection interned", before + pipelined->size(), description_pool().size());
+			pipelined.reset();
+			TEST_EQUAL("all released", before, description_pool().size());
+			std::remove(path.c_str());
+		}
+	);
+
+	//
+	rubric.criterion(
+		"items keep their IDs across loads", 2,
+		[&]()
+		{
+			auto again = load_food_database("food.csv");
+			TEST_TRUE("loaded", again != nullptr);
+			TEST_EQUAL("size", all_foods->size(), again->size());
+			std::unordered_set<uint32_t> ids;
+			for (size_t i = 0; i < all_foods->size(); i++) {
+				TEST_EQUAL("same id", (*all_foods)[i]->id(), (*again)[i]->id());
+				ids.insert((*all_foods)[i]->id());
+			}
+			TEST_EQUAL("unique", all_foods->size(), ids.size());
+
+			FoodIdAssigner first, second;
+			uint32_t a = first.assign("rice,1,2"), b = first.assign("rice,1,2\r");
+			TEST_TRUE("duplicate rows differ", a != b);
+			// Another row in between doesn't change either ID.
+			TEST_EQUAL("first copy", a, second.assign("rice,1,2"));
+			second.assign("beans,3,4");
+			TEST_EQUAL("second copy", b, second.assign("rice,1,2"));
+
+			FoodItem made("test whole corn", 10, 20.0);
+			TEST_EQUAL("content id", food_content_id(made.description_id(), 10, 20.0), made.id());
+
+			auto pipelined = pipelined_dynamic_max_weight("food.csv", 1, 2500, 100, 2000, default_thread_pool(), 64);
+			auto streamed = streaming_dynamic_max_weight("food.csv", 1, 2500, 100, 2000);
+			auto solved = dynamic_max_weight(*filter_food_vector(*all_foods, 1, 2500, 100), 2000);
+			TEST_EQUAL("pipelined size", solved->size(), pipelined->size());
+			TEST_EQUAL("streamed size", solved->size(), streamed->size());
+			for (size_t i = 0; i < solved->size(); i++) {
+				TEST_EQUAL("pipelined id", (*solved)[i]->id(), (*pipelined)[i]->id());
+				TEST_EQUAL("streamed id", (*solved)[i]->id(), (*streamed)[i]->id());
+			}
+		}
+	);
+
+	//
+	rubric.criterion(
+		"reachable calorie totals cut the table short", 2,
+		[&]()
+		{
+			FoodVector small;
+			small.push_back(std::make_shared<FoodItem>("test rice", 3, 1.0));
+			small.push_back(std::make_shared<FoodItem>("test beans", 4.5, 1.0));
+			small.push_back(std::make_shared<FoodItem>("test corn", 70, 1.0));
+			auto reach = reachable_calorie_totals(small, 100);
+			TEST_EQUAL("two words", 2, reach.size());
+			// 4.5 calories counts as 5.
+			TEST_EQUAL("low totals", (1u << 0) | (1u << 3) | (1u << 5) | (1u << 8), reach[0]);
+			TEST_EQUAL("high totals", (1u << (70 - 64)) | (1u << (73 - 64)) | (1u << (75 - 64)) | (1u << (78 - 64)), reach[1]);
+			TEST_EQUAL("largest", 78, largest_reachable_calorie_total(small, 100));
+			TEST_EQUAL("whole budget", 75, largest_reachable_calorie_total(small, 75));
+			TEST_EQUAL("negative", -1, largest_reachable_calorie_total(small, -1));
+
+			// Compare with tables over every column. The first list leaves
+			// most of the budget unreachable; the second has calories that
+			// are multiples of 128, so whole words of columns are skipped.
+			FoodVector sparse;
+			for (int i = 0; i < 40; i++) {
+				sparse.push_back(std::make_shared<FoodItem>("test sparse", 128 * (1 + i % 7), (i * 37) % 50 - 5.0));
+			}
+			auto foods = filter_food_vector(*all_foods, 1, 2500, 100);
+			for (auto list : {foods.get(), &sparse}) {
+				for (double limit : {2000.0, 30000.0, 1e5}) {
+					StreamingDynamicSolver full(limit);
+					for (auto & food : *list) {
+						full.add(food->calorie(), food->weight());
+					}
+					DynamicScratch scratch;
+					auto selection = dynamic_max_weight_indices(*list, limit, scratch);
+					TEST_EQUAL("cut off", largest_reachable_calorie_total(*list, limit) + 1, scratch.columns);
+					TEST_TRUE("same selection", full.selection() == selection);
+
+					SolverCache cache(1 << 20, 64 << 20);
+					TEST_EQUAL("cached table weight", full.max_weight(), cache.max_weight(*list, limit));
+					auto cached = cache.dynamic_max_weight(*list, limit / 2);
+					auto solved = dynamic_max_weight(*list, limit / 2);
+					TEST_EQUAL("cached table selection", solved->size(), cached->size());
+					for (size_t i = 0; i < solved->size(); i++) {
+						TEST_EQUAL("cached table item", (*solved)[i]->id(), (*cached)[i]->id());
+					}
+				}
+			}
+		}
+	);
+
+	//
+	rubric.criterion(
+		"grouped_dynamic_max_weight matches dynamic_max_weight", 2,
+		[&]()
+		{
+			std::vector<uint32_t> split;
+			auto merged = max_plus_convolution({0, 1, 5}, {0, 4}, 10, &split);
+			TEST_EQUAL("width", 4, merged.size());
+			TEST_TRUE("profile", merged == std::vector<double>({0, 4, 5, 9}));
+			TEST_TRUE("splits", split == std::vector<uint32_t>({0, 0, 1, 2}));
+			TEST_EQUAL("past the end", 9, profile_weight(merged, 100));
+
+			ThreadPool pool(3);
+			auto foods = filter_food_vector(*all_foods, 1, 2500, 300);
+			for (size_t groups : {1, 2, 3, 7}) {
+				for (double limit : {0.0, 9.0, 14.0, 500.0, 2000.0}) {
+					for (auto list : {&trivial_foods, foods.get()}) {
+						auto expected = dynamic_max_weight(*list, limit);
+						auto actual = grouped_dynamic_max_weight(*list, limit, groups, pool);
+						double expected_calories, expected_weight, actual_calories, actual_weight;
+						sum_food_vector(*expected, expected_calories, expected_weight);
+						sum_food_vector(*actual, actual_calories, actual_weight);
+						TEST_EQUAL("same weight", std::round(expected_weight * 1e6), std::round(actual_weight * 1e6));
+						TEST_TRUE("within limit", actual_calories <= limit);
+					}
+				}
+			}
+			auto selection = grouped_dynamic_max_weight(*foods, 2000, 4, pool);
+			for (size_t i = 1; i < selection->size(); i++) {
+				auto position = [&](const std::shared_ptr<FoodItem> & food) {
+					return std::find(foods->begin(), foods->end(), food) - foods->begin();
+				};
+				TEST_TRUE("last item first", position((*selection)[i - 1]) > position((*selection)[i]));
+			}
+		}
+	);
+
+	//
+	rubric.criterion(
+		"bucketed_dynamic_max_weight matches dynamic_max_weight", 2,
+		[&]()
+		{
+			// Few distinct calories, some fractional, and some weights
+			// that aren't worth taking.
+			FoodVector repeated;
+			for (int i = 0; i < 200; i++) {
+				repeated.push_back(std::make_shared<FoodItem>("test repeated", (i % 5 + 1) * 3 + (i % 2 ? 0.5 : 0), (i * 37) % 23 - 3.0));
+			}
+			for (auto list : {&trivial_foods, &repeated, filtered_foods.get()}) {
+				for (double limit : {0.0, 9.0, 14.0, 500.0, 2000.0}) {
+					auto expected = dynamic_max_weight(*list, limit);
+					auto actual = bucketed_dynamic_max_weight(*list, limit);
+					double expected_calories, expected_weight, actual_calories, actual_weight;
+					sum_food_vector(*expected, expected_calories, expected_weight);
+					sum_food_vector(*actual, actual_calories, actual_weight);
+					TEST_EQUAL("same weight", std::round(expected_weight * 1e6), std::round(actual_weight * 1e6));
+					TEST_TRUE("within limit", actual_calories <= limit);
+				}
+			}
+			auto pasta = bucketed_dynamic_max_weight(trivial_foods, 9);
+			TEST_EQUAL("pasta only", 1, pasta->size());
+			TEST_EQUAL("pasta only", "test pasta", (*pasta)[0]->description());
+		}
+	);
+
+	//
+	rubric.criterion(
+		"LeaveOutSensitivity matches solving without the items", 2,
+		[&]()
+		{
+			auto best_weight = [](const FoodVector & foods, double limit) {
+				double calories, weight;
+				sum_food_vector(*dynamic_max_weight(foods, limit), calories, weight);
+				return std::round(weight * 1e6);
+			};
+			auto foods = filter_food_vector(*all_foods, 1, 2500, 60);
+			for (auto list : {&trivial_foods, foods.get()}) {
+				for (double limit : {9.0, 500.0}) {
+					LeaveOutSensitivity sensitivity(*list, limit);
+					TEST_EQUAL("all items", best_weight(*list, limit), std::round(sensitivity.max_weight() * 1e6));
+					TEST_EQUAL("one answer per item", list->size(), sensitivity.without_each_item().size());
+					for (size_t i = 0; i < list->size(); i++) {
+						FoodVector rest(*list);
+						rest.erase(rest.begin() + i);
+						TEST_EQUAL("without item", best_weight(rest, limit), std::round(sensitivity.without_item(i) * 1e6));
+					}
+					size_t n = list->size();
+					for (auto range : std::vector<std::pair<size_t, size_t>>{{0, n}, {0, 0}, {1, 2}, {n / 3, n - 1}, {n - 1, n}}) {
+						FoodVector rest(*list);
+						rest.erase(rest.begin() + range.first, rest.begin() + range.second);
+						TEST_EQUAL("without range", best_weight(rest, limit), std::round(sensitivity.without_items(range.first, range.second) * 1e6));
+					}
+				}
+			}
+			TEST_EQUAL("nothing", 0, LeaveOutSensitivity(FoodVector(), 100).max_weight());
+		}
+	);
+
+	//
+	rubric.criterion(
+		"interval_max_weights matches solving each slice", 2,
+		[&]()
+		{
+			auto foods = filter_food_vector(*all_foods, 1, 2500, 90);
+			size_t n = foods->size();
+			std::vector<IntervalQuery> queries = {{0, n, 2000}, {0, 0, 100}, {5, 6, 1000}, {n - 1, n, 1000}, {10, 80, -1}, {0, 1, 0}};
+			for (size_t i = 0; i < 40; i++) {
+				size_t a = (i * 7919) % (n + 1), b = (i * 104729 + 13) % (n + 1);
+				queries.push_back(IntervalQuery{std::min(a, b), std::max(a, b), double((i * 131) % 1500)});
+			}
+			// Same slice twice, and a repeated end.
+			queries.push_back(IntervalQuery{20, 70, 700});
+			queries.push_back(IntervalQuery{20, 70, 300});
+			queries.push_back(IntervalQuery{30, 70, 300});
+			auto answers = interval_max_weights(*foods, queries);
+			TEST_EQUAL("one answer per query", queries.size(), answers.size());
+			for (size_t q = 0; q < queries.size(); q++) {
+				FoodVector slice(foods->begin() + queries[q].first, foods->begin() + queries[q].end);
+				double calories, weight;
+				sum_food_vector(*dynamic_max_weight(slice, queries[q].total_calorie), calories, weight);
+				TEST_EQUAL("same weight", std::round(weight * 1e6), std::round(answers[q] * 1e6));
+			}
+			TEST_TRUE("no queries", interval_max_weights(*foods, {}).empty());
+		}
+	);
+
 	return rubric.run();
 }
 
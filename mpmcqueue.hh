@@ -0,0 +1,234 @@
+///////////////////////////////////////////////////////////////////////////////
+// mpmcqueue.hh
+//
+// Bounded lock-free multi-producer, multi-consumer queue, for handing
+// batches between pipeline stages.
+//
+// How to use:
+//
+//  MpmcQueue<Batch> queue(64);
+//  // producers
+//  queue.push(std::move(batch));  // false once the queue is closed
+//  // consumers
+//  for (Batch batch; queue.pop(batch);) { ... }
+//  // when the producers are done
+//  queue.close();
+//
+// The queue is a ring of cells, each with a sequence number that says
+// whether it is ready to be written or read in the current lap of the ring
+// (D. Vyukov's bounded MPMC queue). Producers and consumers each claim a
+// position with one compare-and-swap and never take a lock. Only a thread
+// that finds the queue full or empty, and is told to block, waits on a
+// condition variable, and the other side only touches it when a thread is
+// actually waiting.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// What push and pop do when the queue is full or empty.
+enum class QueueWait {
+  // Spin, yielding the CPU between attempts. Lowest latency when every
+  // stage has a core of its own.
+  SPIN,
+  // Spin briefly, then sleep until the other side makes progress.
+  BLOCK
+};
+
+template <typename T>
+class MpmcQueue {
+public:
+  // Room for capacity values, rounded up to a power of 2.
+  explicit MpmcQueue(size_t capacity, QueueWait wait = QueueWait::BLOCK)
+  : _wait(wait), _closed(false) {
+    size_t size = 2;
+    while (size < capacity) {
+      size *= 2;
+    }
+    _mask = size - 1;
+    _cells.reset(new Cell[size]);
+    for (size_t i = 0; i < size; i++) {
+      _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    _push_position.store(0, std::memory_order_relaxed);
+    _pop_position.store(0, std::memory_order_relaxed);
+  }
+
+  MpmcQueue(const MpmcQueue &) = delete;
+  MpmcQueue & operator=(const MpmcQueue &) = delete;
+
+  // Append value if there is room. Returns false, leaving value alone, if
+  // the queue is full.
+  bool try_push(T & value) {
+    size_t position = _push_position.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell & cell = _cells[position & _mask];
+      size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      intptr_t lap = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+      if (lap == 0) {
+        if (_push_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          cell.value = std::move(value);
+          cell.sequence.store(position + 1, std::memory_order_release);
+          wake(_not_empty);
+          return true;
+        }
+      } else if (lap < 0) {
+        return false;
+      } else {
+        position = _push_position.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Take the oldest value if there is one.
+  bool try_pop(T & value) {
+    size_t position = _pop_position.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell & cell = _cells[position & _mask];
+      size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      intptr_t lap = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+      if (lap == 0) {
+        if (_pop_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          value = std::move(cell.value);
+          cell.sequence.store(position + _mask + 1, std::memory_order_release);
+          wake(_not_full);
+          return true;
+        }
+      } else if (lap < 0) {
+        return false;
+      } else {
+        position = _pop_position.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Wait for room and append value. Returns false, dropping value, if the
+  // queue is closed.
+  bool push(T value) {
+    return wait_for(_not_full, [&]() { return try_push(value); }, [&]() { return ready(_push_position, 0); });
+  }
+
+  // Wait for a value and take it. Returns false once the queue is closed
+  // and empty.
+  bool pop(T & value) {
+    if (wait_for(_not_empty, [&]() { return try_pop(value); }, [&]() { return ready(_pop_position, 1); })) {
+      return true;
+    }
+    // Closed: drain what is left.
+    return try_pop(value);
+  }
+
+  // No more pushes; pops drain what is left. Wakes every waiting thread.
+  void close() {
+    _closed.store(true);
+    for (Event * event: {&_not_full, &_not_empty}) {
+      std::lock_guard<std::mutex> lock(event->mutex);
+      event->condition.notify_all();
+    }
+  }
+
+  bool closed() const {
+    return _closed.load();
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  // Where threads sleep while the queue is full, or empty.
+  struct Event {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::atomic<unsigned> waiters{0};
+  };
+
+  static void pause() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+  }
+
+  void wake(Event & event) {
+    // Spinning queues have no sleepers, so skip the fence as well.
+    if (_wait != QueueWait::BLOCK) {
+      return;
+    }
+    // Pairs with the fence in wait_for: either the waiter sees the new
+    // value when it tries again, or this sees the waiter.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (event.waiters.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> lock(event.mutex);
+      event.condition.notify_all();
+    }
+  }
+
+  // Whether the cell at position is (or was, if position moved on) ready
+  // to be written (lap 0) or read (lap 1), i.e. whether trying is
+  // worthwhile.
+  bool ready(const std::atomic<size_t> & position, size_t lap) const {
+    size_t at = position.load(std::memory_order_relaxed);
+    size_t sequence = _cells[at & _mask].sequence.load(std::memory_order_acquire);
+    return static_cast<intptr_t>(sequence) - static_cast<intptr_t>(at + lap) >= 0;
+  }
+
+  // Call attempt until it succeeds, waiting on event in between. Returns
+  // false if the queue is closed first.
+  // A blocking waiter registers itself, then checks ready() under the
+  // event's mutex; wake() publishes before it checks for waiters and
+  // notifies under the same mutex, so a wakeup can't fall in between.
+  template <typename Attempt, typename Ready>
+  bool wait_for(Event & event, Attempt attempt, Ready ready) {
+    for (unsigned spins = 0; ; spins++) {
+      if (_closed.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      if (attempt()) {
+        return true;
+      }
+      if (spins < 64) {
+        pause();
+      } else if (_wait == QueueWait::SPIN || spins < 128) {
+        std::this_thread::yield();
+      } else {
+        event.waiters.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        {
+          std::unique_lock<std::mutex> lock(event.mutex);
+          if (!_closed.load() && !ready()) {
+            event.condition.wait(lock);
+          }
+        }
+        event.waiters.fetch_sub(1);
+      }
+    }
+  }
+
+  QueueWait _wait;
+  std::atomic<bool> _closed;
+  size_t _mask;
+  std::unique_ptr<Cell[]> _cells;
+  // Each on its own cache line, so producers and consumers don't contend.
+  alignas(64) std::atomic<size_t> _push_position;
+  alignas(64) std::atomic<size_t> _pop_position;
+  alignas(64) Event _not_full;
+  Event _not_empty;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// mpmcqueue.hh
+///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,295 @@
+///////////////////////////////////////////////////////////////////////////////
+// outofcore.hh
+//
+// Dynamic programming solvers for tables too large to keep in memory.
+//
+// spilled_dynamic_max_weight keeps the take bits in a memory-mapped scratch
+// file, so a table beyond RAM costs disk bandwidth instead of running out
+// of memory.
+//
+// checkpointed_dynamic_max_weight keeps no take bits at all, only the DP
+// row at every sqrt(n)-th item, appended to a checkpoint file. A solve
+// that is interrupted resumes from the last row in the file, and the take
+// bits are recomputed one block at a time during reconstruction.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "maxweight.hh"
+#include "solvercache.hh"
+
+// Compute the same optimal set of food items as dynamic_max_weight, with
+// the take bits in an anonymous scratch file created (and immediately
+// unlinked) in scratch_directory and mapped into memory; only the two
+// rolling rows are held in RAM.
+// Rows are written front to back with the mapping advised as sequential,
+// then reconstruction reads them back to front, prefetching a window of
+// rows ahead of it and unmapping the pages of the rows it is done with.
+// Returns nullptr if the scratch file can't be created.
+std::unique_ptr<FoodVector> spilled_dynamic_max_weight(
+  const FoodVector & foodItems,
+    double totalCalorieLimit,
+    const std::string & scratch_directory = "/tmp"
+) {
+  if (totalCalorieLimit < 0) {
+    return std::make_unique<FoodVector>();
+  }
+
+  std::size_t foodCount = foodItems.size();
+  std::size_t columns = static_cast<std::size_t>(totalCalorieLimit) + 1;
+  std::size_t wordsPerRow = (columns + 63) / 64;
+  std::size_t rowBytes = wordsPerRow * sizeof(uint64_t);
+  std::size_t fileBytes = std::max<size_t>(1, foodCount * rowBytes);
+
+  std::string path = scratch_directory + "/maxweight-take-XXXXXX";
+  int fd = mkstemp(&path[0]);
+  if (fd < 0) {
+    std::cout << "Failed to create DP scratch file in " << scratch_directory << ": " << std::strerror(errno) << std::endl;
+    return nullptr;
+  }
+  unlink(path.c_str());
+  if (ftruncate(fd, fileBytes) != 0) {
+    std::cout << "Failed to size DP scratch file to " << fileBytes << " bytes: " << std::strerror(errno) << std::endl;
+    close(fd);
+    return nullptr;
+  }
+  void * mapping = mmap(nullptr, fileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    std::cout << "Failed to map DP scratch file: " << std::strerror(errno) << std::endl;
+    return nullptr;
+  }
+  uint64_t * takeBits = static_cast<uint64_t *>(mapping);
+  char * bytes = static_cast<char *>(mapping);
+
+  madvise(mapping, fileBytes, MADV_SEQUENTIAL);
+  std::vector<double> previousRow(columns, 0), currentRow(columns);
+  for (size_t index = 1; index <= foodCount; index++) {
+    dynamic_programming_row(
+      previousRow.data(),
+      currentRow.data(),
+      takeBits + (index - 1) * wordsPerRow,
+      columns,
+      foodItems[index - 1]->calorie(),
+      foodItems[index - 1]->weight()
+    );
+    std::swap(previousRow, currentRow);
+  }
+
+  // Reconstruction touches one word per row going backwards, which
+  // readahead can't predict, so prefetch whole windows of rows explicitly.
+  madvise(mapping, fileBytes, MADV_RANDOM);
+  const size_t page = sysconf(_SC_PAGESIZE);
+  const size_t windowRows = std::max<size_t>(1, (size_t(16) << 20) / rowBytes);
+  size_t windowStart = foodCount;
+  auto pageAligned = [&](size_t offset) { return offset / page * page; };
+  auto takeRow = [&](size_t index) {
+    if (index < windowStart) {
+      size_t newStart = index + 1 > windowRows ? index + 1 - windowRows : 0;
+      if (windowStart < foodCount) {
+        // Done with the previous window.
+        size_t from = pageAligned(windowStart * rowBytes);
+        size_t to = std::min(fileBytes, (windowStart + windowRows) * rowBytes);
+        if (to > from) {
+          madvise(bytes + from, to - from, MADV_DONTNEED);
+        }
+      }
+      size_t from = pageAligned(newStart * rowBytes);
+      madvise(bytes + from, (index + 1) * rowBytes - from, MADV_WILLNEED);
+      windowStart = newStart;
+    }
+    return static_cast<const uint64_t *>(takeBits + index * wordsPerRow);
+  };
+
+  std::unique_ptr<FoodVector> optimalFoodSelection(new FoodVector);
+  for (size_t index: reconstruct_dynamic_selection(foodItems, takeRow, totalCalorieLimit)) {
+    optimalFoodSelection->push_back(foodItems[index]);
+  }
+  munmap(mapping, fileBytes);
+  return optimalFoodSelection;
+}
+
+// Header of a checkpoint file, followed by DP rows of columns doubles each:
+// the row before item 0, before item block, before item 2 * block, and so
+// on, ending with the final row once the solve is complete.
+struct DynamicCheckpointHeader {
+  uint64_t magic;
+  FoodFingerprint foods;
+  double total_calorie;
+  uint64_t food_count, columns, block;
+};
+
+const uint64_t DYNAMIC_CHECKPOINT_MAGIC = 0x314b4843574d4158ULL; // "MAXWCHK1"
+
+// Compute the same optimal set of food items as dynamic_max_weight, in a
+// way that can be stopped and resumed, in O(sqrt(n) * C) memory instead of
+// O(n * C) take bits.
+// The items are processed in blocks of block items (0 means sqrt(n)). After
+// each block the current DP row is appended to checkpoint_path and synced.
+// If checkpoint_path already holds rows for the same foods and limit, the
+// solve resumes after the last complete one. When interrupted is given and
+// becomes true, the solve stops at the next checkpoint and returns nullptr;
+// calling again resumes it.
+// Reconstruction walks the blocks from last to first, recomputing each
+// block's take bits from its checkpointed starting row, i.e. about one
+// extra pass over the items. The checkpoint file is removed once the
+// solution is found. Returns nullptr, keeping the file, on I/O errors.
+std::unique_ptr<FoodVector> checkpointed_dynamic_max_weight(
+  const FoodVector & foodItems,
+    double totalCalorieLimit,
+    const std::string & checkpoint_path,
+    size_t block = 0,
+    const std::atomic<bool> * interrupted = nullptr
+) {
+  if (totalCalorieLimit < 0) {
+    return std::make_unique<FoodVector>();
+  }
+
+  std::size_t foodCount = foodItems.size();
+  std::size_t columns = static_cast<std::size_t>(totalCalorieLimit) + 1;
+  std::size_t wordsPerRow = (columns + 63) / 64;
+  std::size_t rowBytes = columns * sizeof(double);
+  if (block == 0) {
+    block = std::max<size_t>(1, std::ceil(std::sqrt(double(foodCount))));
+  }
+  std::size_t blockCount = (foodCount + block - 1) / block;
+
+  DynamicCheckpointHeader header{};
+  header.magic = DYNAMIC_CHECKPOINT_MAGIC;
+  header.foods = fingerprint_food_vector(foodItems);
+  header.total_calorie = totalCalorieLimit;
+  header.food_count = foodCount;
+  header.columns = columns;
+  header.block = block;
+
+  auto fail = [&](const std::string & what, int fd) {
+    std::cout << "Checkpointed solve failed; " << what << " " << checkpoint_path << ": " << std::strerror(errno) << std::endl;
+    if (fd >= 0) {
+      close(fd);
+    }
+    return nullptr;
+  };
+
+  int fd = open(checkpoint_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return fail("Cannot open", fd);
+  }
+
+  // Rows already in the file, if it belongs to this problem; otherwise
+  // start it over.
+  size_t rowsStored = 0;
+  struct stat status;
+  DynamicCheckpointHeader existing{};
+  if (fstat(fd, &status) == 0 &&
+      status.st_size >= static_cast<off_t>(sizeof(existing)) &&
+      pread(fd, &existing, sizeof(existing), 0) == static_cast<ssize_t>(sizeof(existing)) &&
+      std::memcmp(&existing, &header, sizeof(header)) == 0) {
+    rowsStored = std::min<size_t>(blockCount + 1, (status.st_size - sizeof(header)) / rowBytes);
+  }
+  // Drop a partly written row, or everything if the header didn't match.
+  if (ftruncate(fd, sizeof(header) + rowsStored * rowBytes) != 0) {
+    return fail("Cannot truncate", fd);
+  }
+  if (rowsStored == 0 && pwrite(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+    return fail("Cannot write", fd);
+  }
+
+  auto rowOffset = [&](size_t row) {
+    return static_cast<off_t>(sizeof(header) + row * rowBytes);
+  };
+  auto readRow = [&](size_t row, std::vector<double> & values) {
+    values.resize(columns);
+    return pread(fd, values.data(), rowBytes, rowOffset(row)) == static_cast<ssize_t>(rowBytes);
+  };
+
+  std::vector<double> previousRow(columns, 0), currentRow(columns);
+  if (rowsStored == 0) {
+    if (pwrite(fd, previousRow.data(), rowBytes, rowOffset(0)) != static_cast<ssize_t>(rowBytes) || fsync(fd) != 0) {
+      return fail("Cannot write", fd);
+    }
+    rowsStored = 1;
+  } else if (!readRow(rowsStored - 1, previousRow)) {
+    return fail("Cannot read", fd);
+  }
+
+  // Forward pass, from the last checkpoint to the final row.
+  std::vector<uint64_t> takeBits(block * wordsPerRow);
+  for (size_t b = rowsStored - 1; b < blockCount; b++) {
+    if (interrupted && *interrupted) {
+      close(fd);
+      return nullptr;
+    }
+    for (size_t index = b * block; index < std::min(foodCount, (b + 1) * block); index++) {
+      dynamic_programming_row(
+        previousRow.data(),
+        currentRow.data(),
+        takeBits.data(),
+        columns,
+        foodItems[index]->calorie(),
+        foodItems[index]->weight()
+      );
+      std::swap(previousRow, currentRow);
+    }
+    if (pwrite(fd, previousRow.data(), rowBytes, rowOffset(b + 1)) != static_cast<ssize_t>(rowBytes) || fsync(fd) != 0) {
+      return fail("Cannot write", fd);
+    }
+  }
+
+  // Reconstruction: when it steps into a block, recompute that block's take
+  // bits from the block's starting row.
+  size_t loadedBlock = blockCount;
+  bool readFailed = false;
+  auto takeRow = [&](size_t index) {
+    size_t b = index / block;
+    if (b != loadedBlock) {
+      readFailed = readFailed || !readRow(b, previousRow);
+      for (size_t item = b * block; item < std::min(foodCount, (b + 1) * block); item++) {
+        dynamic_programming_row(
+          previousRow.data(),
+          currentRow.data(),
+          takeBits.data() + (item - b * block) * wordsPerRow,
+          columns,
+          foodItems[item]->calorie(),
+          foodItems[item]->weight()
+        );
+        std::swap(previousRow, currentRow);
+      }
+      loadedBlock = b;
+    }
+    return static_cast<const uint64_t *>(takeBits.data() + (index - b * block) * wordsPerRow);
+  };
+  std::vector<size_t> selection = reconstruct_dynamic_selection(foodItems, takeRow, totalCalorieLimit);
+  if (readFailed) {
+    return fail("Cannot read", fd);
+  }
+
+  close(fd);
+  unlink(checkpoint_path.c_str());
+
+  std::unique_ptr<FoodVector> optimalFoodSelection(new FoodVector);
+  for (size_t index: selection) {
+    optimalFoodSelection->push_back(foodItems[index]);
+  }
+  return optimalFoodSelection;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// outofcore.hh
+///////////////////////////////////////////////////////////////////////////////
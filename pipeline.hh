@@ -0,0 +1,322 @@
+///////////////////////////////////////////////////////////////////////////////
+// pipeline.hh
+//
+// Load, filter and solve the food database as a pipeline, so that parsing
+// the CSV overlaps with the dynamic programming instead of finishing
+// before it starts.
+//
+//   reader --raw lines--> parse tasks (pool) --items--> filter --> solver
+//
+// The reader hands each batch of lines to the thread pool as a parse task,
+// and the parsed batches reach the filter through a bounded lock-free
+// queue (mpmcqueue.hh). The reader keeps no more batches in flight than
+// that queue holds, so a slow stage holds back the ones before it instead
+// of letting batches pile up, and parse tasks never block a worker. The
+// filter stage puts the batches back in file order, since
+// filter_food_vector keeps the first total_size matches. Parse tasks only
+// split the rows into fields; the filter makes FoodItems, and interns
+// descriptions, for the rows that pass it alone.
+// The reader and the filter are threads of their own rather than pool
+// tasks: both spend most of their time blocked, on the file or on the
+// queues between stages, and a worker blocked there couldn't parse. On a
+// pool with one worker, or when the caller is a worker, that would stop
+// the pipeline. While the reader waits for room, it parses its own queued
+// batches that no worker has started yet.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "maxweight.hh"
+#include "mpmcqueue.hh"
+#include "streaming.hh"
+#include "threadpool.hh"
+
+// How much one stage processed, and the time it spent doing it (not
+// waiting on its queues). For the parse stage the time is summed over its
+// tasks.
+struct PipelineStageStats {
+  std::string name;
+  size_t rows = 0;
+  double busy_seconds = 0;
+
+  double rows_per_second() const {
+    return busy_seconds > 0 ? rows / busy_seconds : 0;
+  }
+};
+
+struct PipelineStats {
+  // reader, parse, filter and solve, in that order.
+  std::vector<PipelineStageStats> stages;
+  double seconds = 0;
+};
+
+// Compute the same optimal set of food items as
+//   dynamic_max_weight(*filter_food_vector(*load_food_database(path),
+//                        min_weight, max_weight, total_size), totalCalorieLimit)
+// with the load, filter and solve pipelined. Batches of batch_rows lines
+// are parsed on pool, at most two per worker at a time. If stats is given
+// it receives the throughput of each stage.
+// The file may be compressed, and invalid rows are skipped, as by
+// load_food_database. Returns nullptr if the file can't be read.
+std::unique_ptr<FoodVector> pipelined_dynamic_max_weight(
+  const std::string & path,
+    double min_weight,
+    double max_weight,
+    int total_size,
+    double totalCalorieLimit,
+    ThreadPool & pool = default_thread_pool(),
+    size_t batch_rows = 512,
+    PipelineStats * stats = nullptr
+) {
+  typedef std::chrono::steady_clock Clock;
+  auto since = [](Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+  };
+  Clock::time_point started = Clock::now();
+
+  CatalogInputStream f(path);
+  if (!f) {
+    std::cout << "Failed to load food database; Cannot open file: " << path << std::endl;
+    return nullptr;
+  }
+  batch_rows = std::max<size_t>(1, batch_rows);
+
+  struct RawBatch {
+    size_t sequence;
+    std::vector<std::string> lines;
+    // The item ID of each line, assigned in file order.
+    std::vector<uint32_t> ids;
+  };
+  struct RowBatch {
+    size_t sequence;
+    // The rows' descriptions point into lines, whose strings stay where
+    // they are when the batch is moved.
+    std::vector<std::string> lines;
+    std::vector<FoodRow> rows;
+    std::vector<uint32_t> ids;
+  };
+  struct ItemBatch {
+    size_t sequence;
+    FoodVector items;
+  };
+
+  // A few batches per worker keeps them all busy. Every batch in flight
+  // has a place in parsed, so parse tasks never wait to push.
+  size_t capacity = 2 * pool.size();
+  MpmcQueue<RowBatch> parsed(capacity);
+  MpmcQueue<ItemBatch> filtered(4);
+  std::mutex slots_mutex;
+  std::condition_variable slot_freed;
+  size_t in_flight = 0;
+  bool stopped = false;
+
+  // Stop the earlier stages once total_size items passed the filter.
+  auto stop = [&]() {
+    {
+      std::lock_guard<std::mutex> lock(slots_mutex);
+      stopped = true;
+    }
+    slot_freed.notify_all();
+    parsed.close();
+  };
+
+  std::vector<PipelineStageStats> stages(4);
+  stages[0].name = "read";
+  stages[1].name = "parse";
+  stages[2].name = "filter";
+  stages[3].name = "solve";
+  std::mutex parse_stats_mutex;
+
+  auto parse = [&](RawBatch & batch) {
+    Clock::time_point busy = Clock::now();
+    RowBatch rows{batch.sequence, std::move(batch.lines), {}, {}};
+    std::string reason;
+    for (size_t i = 0; i < rows.lines.size(); i++) {
+      FoodRow row;
+      if (parse_food_row(rows.lines[i], row, reason)) {
+        rows.rows.push_back(row);
+        rows.ids.push_back(batch.ids[i]);
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(parse_stats_mutex);
+      stages[1].rows += rows.lines.size();
+      stages[1].busy_seconds += since(busy);
+    }
+    parsed.push(std::move(rows));
+  };
+
+  // Batches handed off but not yet taken by a parse task. Each task parses
+  // whichever batch is first, so the reader can take one too.
+  std::mutex unclaimed_mutex;
+  std::deque<RawBatch> unclaimed;
+  auto parse_next = [&]() {
+    RawBatch batch;
+    {
+      std::lock_guard<std::mutex> lock(unclaimed_mutex);
+      if (unclaimed.empty()) {
+        return false;
+      }
+      batch = std::move(unclaimed.front());
+      unclaimed.pop_front();
+    }
+    parse(batch);
+    return true;
+  };
+
+  // Wait for a batch's place in parsed, parsing batches no worker has
+  // started meanwhile, in case the workers are busy or the caller is itself
+  // one of them. Returns false once the pipeline is stopped.
+  auto take_slot = [&]() {
+    std::unique_lock<std::mutex> lock(slots_mutex);
+    while (!stopped && in_flight >= capacity) {
+      lock.unlock();
+      bool helped = parse_next();
+      lock.lock();
+      if (!helped) {
+        // Every batch in flight is being parsed, or waits for the filter,
+        // which frees its place.
+        slot_freed.wait(lock, [&]() {
+          return stopped || in_flight < capacity;
+        });
+      }
+    }
+    if (stopped) {
+      return false;
+    }
+    in_flight++;
+    return true;
+  };
+
+  std::thread reader([&]() {
+    TaskGroup parsers(pool);
+    size_t line_number = 0, sequence = 0;
+    FoodIdAssigner ids;
+    RawBatch batch{0, {}, {}};
+    Clock::time_point busy = Clock::now();
+    auto hand_off = [&]() {
+      stages[0].rows += batch.lines.size();
+      stages[0].busy_seconds += since(busy);
+      if (!take_slot()) {
+        return false;
+      }
+      {
+        std::lock_guard<std::mutex> lock(unclaimed_mutex);
+        unclaimed.push_back(std::move(batch));
+      }
+      parsers.run([&parse_next]() { parse_next(); });
+      batch = RawBatch{++sequence, {}, {}};
+      busy = Clock::now();
+      return true;
+    };
+    for (std::string line; std::getline(f, line);) {
+      // First line is a header row
+      if (++line_number == 1) {
+        continue;
+      }
+      batch.ids.push_back(ids.assign(line));
+      batch.lines.push_back(std::move(line));
+      if (batch.lines.size() == batch_rows && !hand_off()) {
+        break;
+      }
+    }
+    if (!batch.lines.empty()) {
+      hand_off();
+    }
+    while (parse_next()) {
+    }
+    parsers.wait();
+    parsed.close();
+  });
+
+  std::thread filter([&]() {
+    // Batches that arrived ahead of their turn, by sequence number.
+    std::map<size_t, RowBatch> waiting;
+    size_t next_sequence = 0, passed = 0;
+    bool done = false;
+    for (RowBatch batch; !done && parsed.pop(batch);) {
+      {
+        std::lock_guard<std::mutex> lock(slots_mutex);
+        in_flight--;
+      }
+      slot_freed.notify_one();
+      Clock::time_point busy = Clock::now();
+      size_t sequence = batch.sequence;
+      waiting[sequence] = std::move(batch);
+      for (auto found = waiting.find(next_sequence); !done && found != waiting.end(); found = waiting.find(next_sequence)) {
+        ItemBatch out{next_sequence, {}};
+        const RowBatch & rows = found->second;
+        for (size_t i = 0; i < rows.rows.size(); i++) {
+          stages[2].rows++;
+          const FoodRow & row = rows.rows[i];
+          if (row.weight_ounces >= min_weight && row.weight_ounces <= max_weight) {
+            out.items.push_back(make_food_item(row, rows.ids[i]));
+            if (++passed == static_cast<size_t>(total_size)) {
+              done = true;
+              break;
+            }
+          }
+        }
+        waiting.erase(found);
+        next_sequence++;
+        stages[2].busy_seconds += since(busy);
+        if (!out.items.empty()) {
+          filtered.push(std::move(out));
+        }
+        busy = Clock::now();
+      }
+    }
+    if (done) {
+      stop();
+    }
+    filtered.close();
+  });
+
+  // The solver runs on the calling thread.
+  StreamingDynamicSolver solver(totalCalorieLimit);
+  FoodVector foods;
+  for (ItemBatch batch; filtered.pop(batch);) {
+    Clock::time_point busy = Clock::now();
+    for (auto & item: batch.items) {
+      solver.add(item->calorie(), item->weight());
+      foods.push_back(item);
+    }
+    stages[3].rows += batch.items.size();
+    stages[3].busy_seconds += since(busy);
+  }
+
+  reader.join();
+  filter.join();
+
+  if (stats) {
+    stats->stages = stages;
+    stats->seconds = since(started);
+  }
+  if (!f.error().empty()) {
+    std::cout << "Failed to load food database; Cannot read file: " << path << ": " << f.error() << std::endl;
+    return nullptr;
+  }
+  std::unique_ptr<FoodVector> optimalFoodSelection(new FoodVector);
+  for (size_t index: solver.selection()) {
+    optimalFoodSelection->push_back(foods[index]);
+  }
+  return optimalFoodSelection;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pipeline.hh
+///////////////////////////////////////////////////////////////////////////////
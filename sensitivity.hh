@@ -0,0 +1,168 @@
+///////////////////////////////////////////////////////////////////////////////
+// sensitivity.hh
+//
+// How much the best weight depends on each food item: the optimum with any
+// one item, or any contiguous run of items, left out.
+//
+// How to use:
+//
+//  LeaveOutSensitivity sensitivity(foods, 2000);
+//  for (size_t i = 0; i < foods.size(); i++) {
+//    double loss = sensitivity.max_weight() - sensitivity.without_item(i);
+//    ...
+//  }
+//
+// Row F_i of the table over the items before i, and row B_j of the table
+// over the items from j on, combine into the optimum over both sides:
+//
+//   best without items [i, j) = max over a of F_i[a] + B_j[C - a]
+//
+// so every leave-one-out answer costs one O(C) combination instead of a
+// solve. Only every sqrt(n)-th row is kept, as in
+// checkpointed_dynamic_max_weight; the rows in between are recomputed
+// from the nearest kept one when needed. All n answers take three passes
+// over the items, and memory for O(sqrt(n)) rows.
+//
+// The answers are best weights; the selection itself comes from solving
+// the remaining items, e.g. with dynamic_max_weight.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "maxweight.hh"
+
+class LeaveOutSensitivity {
+public:
+  // Computes every without_item() answer up front.
+  LeaveOutSensitivity(const FoodVector & foodItems, double totalCalorieLimit)
+  : _columns(0), _block(1), _max_weight(0) {
+    if (totalCalorieLimit < 0) {
+      return;
+    }
+    // Leaving items out only removes reachable totals, so the cut-off of
+    // the whole list holds for every part of it.
+    _reachable = reachable_calorie_totals(foodItems, totalCalorieLimit);
+    _columns = static_cast<size_t>(largest_reachable_calorie_total(_reachable)) + 1;
+    for (auto & food: foodItems) {
+      _calories.push_back(food->calorie());
+      _weights.push_back(food->weight());
+    }
+
+    size_t n = _calories.size();
+    _block = std::max<size_t>(1, std::sqrt(n));
+    size_t boundaries = (n + _block - 1) / _block + 1;
+    _prefix.resize(boundaries);
+    _suffix.resize(boundaries);
+
+    // Backward pass: suffix rows at the block boundaries.
+    std::vector<double> row(_columns, 0), next(_columns);
+    std::vector<uint64_t> take((_columns + 63) / 64);
+    _suffix.back() = row;
+    for (size_t i = n; i-- > 0;) {
+      add(row, next, take, i);
+      if (i % _block == 0) {
+        _suffix[i / _block] = row;
+      }
+    }
+
+    // Forward pass, one block at a time: the block's suffix rows are
+    // recomputed from the boundary after it, then each item's answer
+    // combines the prefix row before it with the suffix row after it.
+    _without_item.resize(n);
+    std::vector<std::vector<double>> suffixes(_block, std::vector<double>(_columns));
+    row.assign(_columns, 0);
+    for (size_t b = 0; b * _block < n; b++) {
+      size_t first = b * _block, end = std::min(n, first + _block);
+      _prefix[b] = row;
+      // suffixes[t] is the row from item first + 1 + t on.
+      suffixes[end - first - 1] = _suffix[b + 1];
+      for (size_t i = end - 1; i > first; i--) {
+        step(suffixes[i - first], suffixes[i - first - 1], take, i);
+      }
+      for (size_t i = first; i < end; i++) {
+        _without_item[i] = combine(row, suffixes[i - first]);
+        add(row, next, take, i);
+      }
+    }
+    _prefix.back() = row;
+    _max_weight = row.back();
+  }
+
+  // Best weight with every item available.
+  double max_weight() const {
+    return _max_weight;
+  }
+
+  // Best weight without the item at index.
+  double without_item(size_t index) const {
+    return _without_item[index];
+  }
+
+  // without_item() of every item, in order.
+  const std::vector<double> & without_each_item() const {
+    return _without_item;
+  }
+
+  // Best weight without the items in [first, end). Recomputes up to two
+  // blocks of rows, so costs O(sqrt(n) C).
+  double without_items(size_t first, size_t end) const {
+    if (_columns == 0) {
+      return 0;
+    }
+    std::vector<double> next(_columns);
+    std::vector<uint64_t> take((_columns + 63) / 64);
+    std::vector<double> prefix = _prefix[first / _block];
+    for (size_t i = first / _block * _block; i < first; i++) {
+      add(prefix, next, take, i);
+    }
+    size_t b = (end + _block - 1) / _block;
+    std::vector<double> suffix = _suffix[b];
+    for (size_t i = std::min(b * _block, _calories.size()); i > end; i--) {
+      add(suffix, next, take, i - 1);
+    }
+    return combine(prefix, suffix);
+  }
+
+private:
+  // The row after adding item index to the table whose last row is row.
+  // The take bits, which nothing here reads, go to take.
+  void step(const std::vector<double> & row, std::vector<double> & next, std::vector<uint64_t> & take, size_t index) const {
+    dynamic_programming_row(
+      row.data(), next.data(), take.data(), _columns, _calories[index], _weights[index], _reachable.data()
+    );
+  }
+
+  // Same, in place, with next as working memory.
+  void add(std::vector<double> & row, std::vector<double> & next, std::vector<uint64_t> & take, size_t index) const {
+    step(row, next, take, index);
+    std::swap(row, next);
+  }
+
+  // Best weight within the whole budget, split between a prefix row and a
+  // suffix row.
+  double combine(const std::vector<double> & prefix, const std::vector<double> & suffix) const {
+    double best = 0;
+    for (size_t a = 0; a < _columns; a++) {
+      best = std::max(best, prefix[a] + suffix[_columns - 1 - a]);
+    }
+    return best;
+  }
+
+  size_t _columns, _block;
+  std::vector<uint64_t> _reachable;
+  std::vector<double> _calories, _weights;
+  // Rows of the items before, and from, each multiple of _block (and n).
+  std::vector<std::vector<double>> _prefix, _suffix;
+  std::vector<double> _without_item;
+  double _max_weight;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// sensitivity.hh
+///////////////////////////////////////////////////////////////////////////////
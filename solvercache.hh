@@ -0,0 +1,292 @@
+///////////////////////////////////////////////////////////////////////////////
+// solvercache.hh
+//
+// Memoize solutions to repeated (food list, calorie limit) problems.
+//
+// How to use:
+//
+//  SolverCache cache(64 << 20); // hold at most 64 MiB of solutions
+//  auto solution = cache.dynamic_max_weight(foods, 2000);
+//  // same foods and limit again: served from the cache, no DP
+//  solution = cache.dynamic_max_weight(foods, 2000);
+//  std::cout << cache.stats().hits << std::endl;
+//
+//  // also keep up to 256 MiB of DP tables, so that smaller limits on the
+//  // same foods are answered from the table of a larger one
+//  SolverCache cache(64 << 20, 256 << 20);
+//  cache.dynamic_max_weight(foods, 5000);  // full DP
+//  cache.dynamic_max_weight(foods, 1200);  // reconstruction only
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "maxweight.hh"
+
+// A 128-bit hash of the items of a FoodVector, in order.
+struct FoodFingerprint {
+  uint64_t low, high;
+
+  bool operator==(const FoodFingerprint & other) const {
+    return low == other.low && high == other.high;
+  }
+};
+
+// Fingerprint the ID, calories and weight of every item in foods. The ID
+// stands for the item; calories and weight, which are all a solution
+// depends on, stay in so that two items whose 32-bit IDs collide can't
+// share cached solutions. Two lanes with different seeds and multipliers
+// make up the 128 bits.
+FoodFingerprint fingerprint_food_vector(const FoodVector & foods) {
+  uint64_t low = 0x9e3779b97f4a7c15ULL, high = 0xc2b2ae3d27d4eb4fULL;
+  auto add = [&](uint64_t word) {
+    low = mix_hash64(low ^ word) * 0xff51afd7ed558ccdULL;
+    high = mix_hash64(high + word) * 0xc4ceb9fe1a85ec53ULL;
+  };
+  auto add_double = [&](double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    add(bits);
+  };
+
+  add(foods.size());
+  for (auto & food: foods) {
+    add(food->id());
+    add_double(food->calorie());
+    add_double(food->weight());
+  }
+  return FoodFingerprint{mix_hash64(low), mix_hash64(high)};
+}
+
+// Thread-safe, byte-bounded LRU cache of dynamic_max_weight solutions.
+// A solution is stored compactly as the positions of the chosen items, so
+// a hit rebuilds the FoodVector from the caller's foods without any DP.
+// Optionally, the final DP row and take bits of recent food lists are kept
+// too, in a second LRU. Any limit up to the one a table was built for is
+// then answered from it: the best weight is one lookup in the final row,
+// and the selection is a reconstruction from the take bits.
+class SolverCache {
+public:
+  struct Stats {
+    size_t hits = 0, misses = 0, evictions = 0;
+    size_t entries = 0, bytes = 0;
+    // Misses answered from a kept table, and tables evicted.
+    size_t table_hits = 0, table_evictions = 0;
+    size_t tables = 0, table_bytes = 0;
+  };
+
+  // capacity_bytes bounds the memory held by cached solutions, and
+  // table_capacity_bytes the memory held by kept DP tables (0 keeps none).
+  explicit SolverCache(size_t capacity_bytes, size_t table_capacity_bytes = 0)
+  : _capacity_bytes(capacity_bytes), _table_capacity_bytes(table_capacity_bytes) { }
+
+  // Same result as ::dynamic_max_weight(foods, total_calorie).
+  std::unique_ptr<FoodVector> dynamic_max_weight(const FoodVector & foods, double total_calorie) {
+    auto result = std::make_unique<FoodVector>();
+    if (total_calorie < 0) {
+      return result;
+    }
+
+    Key key{fingerprint_food_vector(foods), total_calorie};
+    std::vector<uint32_t> selection;
+    if (!lookup(key, selection)) {
+      std::shared_ptr<const Table> table = find_table(key.fingerprint, total_calorie);
+      if (!table) {
+        table = build_table(foods, key.fingerprint, total_calorie);
+      }
+      for (size_t index: reconstruct_dynamic_selection(foods, table->take_bits.data(), table->words_per_row, total_calorie, table->final_row.size())) {
+        selection.push_back(index);
+      }
+      insert(key, selection);
+    }
+
+    for (uint32_t index: selection) {
+      result->push_back(foods[index]);
+    }
+    return result;
+  }
+
+  // The best total weight within total_calorie, as the solution of
+  // dynamic_max_weight would sum to. Served from a kept table when one is
+  // wide enough, without reconstructing the selection.
+  double max_weight(const FoodVector & foods, double total_calorie) {
+    if (total_calorie < 0) {
+      return 0;
+    }
+    FoodFingerprint fingerprint = fingerprint_food_vector(foods);
+    std::shared_ptr<const Table> table = find_table(fingerprint, total_calorie);
+    if (!table) {
+      table = build_table(foods, fingerprint, total_calorie);
+    }
+    return table->final_row[std::min(static_cast<size_t>(total_calorie), table->final_row.size() - 1)];
+  }
+
+  Stats stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    Stats stats = _stats;
+    stats.entries = _lru.size();
+    stats.bytes = _bytes;
+    stats.tables = _tables.size();
+    stats.table_bytes = _table_bytes;
+    return stats;
+  }
+
+  // Drop every cached solution and table. The counters are kept.
+  void clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _index.clear();
+    _lru.clear();
+    _bytes = 0;
+    _tables.clear();
+    _table_bytes = 0;
+  }
+
+private:
+  struct Key {
+    FoodFingerprint fingerprint;
+    double total_calorie;
+
+    bool operator==(const Key & other) const {
+      return fingerprint == other.fingerprint && total_calorie == other.total_calorie;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key & key) const {
+      uint64_t bits;
+      std::memcpy(&bits, &key.total_calorie, sizeof(bits));
+      return mix_hash64(key.fingerprint.low ^ bits);
+    }
+  };
+
+  struct Entry {
+    Key key;
+    std::vector<uint32_t> selection;
+  };
+
+  typedef std::list<Entry> EntryList;
+
+  // The final row and take bits of a DP over some foods, for every limit
+  // up to columns - 1. The rows may stop short of that, at the largest
+  // reachable total (see DynamicScratch::columns).
+  struct Table {
+    FoodFingerprint fingerprint;
+    size_t columns, words_per_row;
+    std::vector<double> final_row;
+    std::vector<uint64_t> take_bits;
+
+    size_t bytes() const {
+      return sizeof(Table) + final_row.capacity() * sizeof(double)
+        + take_bits.capacity() * sizeof(uint64_t);
+    }
+  };
+
+  // Kept tables, most recently used first. There are few of them, so they
+  // are found by a linear search.
+  typedef std::list<std::shared_ptr<const Table>> TableList;
+
+  // Rough memory held by one entry: list node, hash node, and the selection.
+  static size_t entry_bytes(const Entry & entry) {
+    return sizeof(Entry) + 2 * sizeof(void *)
+      + sizeof(std::pair<Key, EntryList::iterator>) + 2 * sizeof(void *)
+      + entry.selection.capacity() * sizeof(uint32_t);
+  }
+
+  bool lookup(const Key & key, std::vector<uint32_t> & selection) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto found = _index.find(key);
+    if (found == _index.end()) {
+      _stats.misses++;
+      return false;
+    }
+    _lru.splice(_lru.begin(), _lru, found->second);
+    selection = found->second->selection;
+    _stats.hits++;
+    return true;
+  }
+
+  void insert(const Key & key, const std::vector<uint32_t> & selection) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_index.count(key)) {
+      // Another thread solved the same problem meanwhile.
+      return;
+    }
+    _lru.push_front(Entry{key, selection});
+    _index[key] = _lru.begin();
+    _bytes += entry_bytes(_lru.front());
+    while (_bytes > _capacity_bytes && !_lru.empty()) {
+      _bytes -= entry_bytes(_lru.back());
+      _index.erase(_lru.back().key);
+      _lru.pop_back();
+      _stats.evictions++;
+    }
+  }
+
+  std::shared_ptr<const Table> find_table(const FoodFingerprint & fingerprint, double total_calorie) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto it = _tables.begin(); it != _tables.end(); ++it) {
+      if ((*it)->fingerprint == fingerprint && static_cast<size_t>(total_calorie) < (*it)->columns) {
+        _tables.splice(_tables.begin(), _tables, it);
+        _stats.table_hits++;
+        return _tables.front();
+      }
+    }
+    return nullptr;
+  }
+
+  // Run the DP and keep its table if it fits, replacing any narrower table
+  // for the same foods.
+  std::shared_ptr<const Table> build_table(const FoodVector & foods, const FoodFingerprint & fingerprint, double total_calorie) {
+    DynamicScratch scratch;
+    dynamic_max_weight_indices(foods, total_calorie, scratch);
+
+    auto table = std::make_shared<Table>();
+    table->fingerprint = fingerprint;
+    table->columns = static_cast<size_t>(total_calorie) + 1;
+    table->words_per_row = (scratch.columns + 63) / 64;
+    table->final_row = std::move(scratch.previous_row);
+    table->take_bits = std::move(scratch.take_bits);
+
+    size_t bytes = table->bytes();
+    if (bytes > _table_capacity_bytes) {
+      return table;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto it = _tables.begin(); it != _tables.end();) {
+      if ((*it)->fingerprint == fingerprint && (*it)->columns <= table->columns) {
+        _table_bytes -= (*it)->bytes();
+        it = _tables.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    _tables.push_front(table);
+    _table_bytes += bytes;
+    while (_table_bytes > _table_capacity_bytes) {
+      _table_bytes -= _tables.back()->bytes();
+      _tables.pop_back();
+      _stats.table_evictions++;
+    }
+    return table;
+  }
+
+  size_t _capacity_bytes, _table_capacity_bytes;
+  size_t _bytes = 0, _table_bytes = 0;
+  TableList _tables;
+  EntryList _lru;
+  std::unordered_map<Key, EntryList::iterator, KeyHash> _index;
+  Stats _stats;
+  mutable std::mutex _mutex;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// solvercache.hh
+///////////////////////////////////////////////////////////////////////////////
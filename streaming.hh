@@ -0,0 +1,196 @@
+///////////////////////////////////////////////////////////////////////////////
+// streaming.hh
+//
+// Solve the dynamic programming problem while the catalog is being read,
+// without holding it as a FoodVector.
+//
+// StreamingDynamicSolver folds items into the rolling DP row one at a time
+// and keeps only what reconstruction needs: the take bits and the calories
+// of each item. streaming_dynamic_max_weight drives it from the CSV file,
+// remembering where each row starts so the chosen rows can be read again at
+// the end; only those become FoodItems, and only their descriptions are
+// interned, so peak memory doesn't depend on how long the descriptions are.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "maxweight.hh"
+
+class StreamingDynamicSolver {
+public:
+  // Solve for totalCalorieLimit, which must be known before the first item.
+  explicit StreamingDynamicSolver(double totalCalorieLimit)
+  : _total_calorie(totalCalorieLimit),
+    _columns(totalCalorieLimit < 0 ? 0 : static_cast<size_t>(totalCalorieLimit) + 1),
+    _words_per_row((_columns + 63) / 64),
+    _previous_row(_columns, 0),
+    _current_row(_columns) { }
+
+  // Fold in the next item of the stream.
+  void add(double calories, double weight) {
+    _calories.push_back(calories);
+    _take_bits.resize(_take_bits.size() + _words_per_row);
+    dynamic_programming_row(
+      _previous_row.data(),
+      _current_row.data(),
+      _take_bits.data() + _take_bits.size() - _words_per_row,
+      _columns,
+      calories,
+      weight
+    );
+    std::swap(_previous_row, _current_row);
+  }
+
+  // Number of items folded in so far.
+  size_t size() const {
+    return _calories.size();
+  }
+
+  // Best total weight of the items so far.
+  double max_weight() const {
+    return _columns == 0 ? 0 : _previous_row.back();
+  }
+
+  // The optimal selection of the items so far, as their positions in the
+  // stream, last item first (like dynamic_max_weight_indices).
+  std::vector<size_t> selection() const {
+    if (_columns == 0) {
+      return std::vector<size_t>();
+    }
+    return reconstruct_dynamic_selection(
+      _calories.size(),
+      [&](size_t index) { return _calories[index]; },
+      [&](size_t index) { return _take_bits.data() + index * _words_per_row; },
+      _total_calorie
+    );
+  }
+
+private:
+  double _total_calorie;
+  size_t _columns, _words_per_row;
+  std::vector<double> _previous_row, _current_row;
+  std::vector<uint64_t> _take_bits;
+  std::vector<double> _calories;
+};
+
+// Where each row folded into a streaming solve starts in the file, with
+// its item ID and a hash of the whole line, so that chosen rows can be read
+// back and checked against what was solved.
+struct StreamedRows {
+  std::vector<std::streamoff> offsets;
+  std::vector<uint32_t> ids;
+  std::vector<uint64_t> hashes;
+};
+
+// First pass of streaming_dynamic_max_weight: fold the rows of path that
+// pass the filter into solver, and record them in rows. Returns false if
+// the file can't be read or is compressed.
+bool stream_food_rows(
+  const std::string & path,
+    double min_weight,
+    double max_weight,
+    int total_size,
+    StreamingDynamicSolver & solver,
+    StreamedRows & rows
+) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f) {
+    std::cout << "Failed to load food database; Cannot open file: " << path << std::endl;
+    return false;
+  }
+  // The chosen rows are read again by offset, which needs the plain file.
+  char magic[4] = {};
+  f.read(magic, sizeof(magic));
+  if (detect_catalog_compression(reinterpret_cast<unsigned char *>(magic), f.gcount()) != CatalogCompression::NONE) {
+    std::cout << "Failed to load food database; Streaming needs an uncompressed file: " << path << std::endl;
+    return false;
+  }
+  f.clear();
+  f.seekg(0);
+
+  FoodIdAssigner ids;
+  size_t line_number = 0;
+  std::streamoff offset = 0;
+  std::string reason;
+  for (std::string line; std::getline(f, line);) {
+    std::streamoff row_offset = offset;
+    offset = f.tellg();
+    line_number++;
+
+    // First line is a header row
+    if (line_number == 1) {
+      continue;
+    }
+
+    FoodRow row;
+    uint32_t id = ids.assign(line);
+    if (parse_food_row(line, row, reason) && row.weight_ounces >= min_weight && row.weight_ounces <= max_weight) {
+      solver.add(row.calories, row.weight_ounces);
+      rows.offsets.push_back(row_offset);
+      rows.ids.push_back(id);
+      rows.hashes.push_back(hash_string(line).low);
+      if (solver.size() == static_cast<size_t>(total_size)) {
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+// Second pass of streaming_dynamic_max_weight: read the rows at the given
+// positions of rows again, as FoodItems. Returns nullptr if any of them
+// isn't the line that was solved any more.
+std::unique_ptr<FoodVector> read_streamed_rows(
+  const std::string & path,
+    const StreamedRows & rows,
+    const std::vector<size_t> & selection
+) {
+  std::unique_ptr<FoodVector> foods(new FoodVector);
+  std::ifstream f(path, std::ios::binary);
+  std::string reason;
+  for (size_t index: selection) {
+    std::string line;
+    std::shared_ptr<FoodItem> item;
+    f.seekg(rows.offsets[index]);
+    if (!std::getline(f, line) || hash_string(line).low != rows.hashes[index] ||
+        !parse_food_line(line, item, reason, rows.ids[index])) {
+      std::cout << "Failed to load food database; " << path << " changed while solving" << std::endl;
+      return nullptr;
+    }
+    foods->push_back(item);
+  }
+  return foods;
+}
+
+// Compute the same optimal set of food items as
+//   dynamic_max_weight(*filter_food_vector(*load_food_database(path),
+//                        min_weight, max_weight, total_size), totalCalorieLimit)
+// in one pass over the file, solving each row as soon as it is parsed.
+// Returns nullptr if the file can't be read, is compressed, or changes
+// while solving (a chosen row no longer reads back as the same line).
+std::unique_ptr<FoodVector> streaming_dynamic_max_weight(
+  const std::string & path,
+    double min_weight,
+    double max_weight,
+    int total_size,
+    double totalCalorieLimit
+) {
+  StreamingDynamicSolver solver(totalCalorieLimit);
+  StreamedRows rows;
+  if (!stream_food_rows(path, min_weight, max_weight, total_size, solver, rows)) {
+    return nullptr;
+  }
+  return read_streamed_rows(path, rows, solver.selection());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// streaming.hh
+///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,222 @@
+///////////////////////////////////////////////////////////////////////////////
+// stringpool.hh
+//
+// Interned strings: each distinct string is stored once and named by a
+// 32-bit ID, so equal strings compare and hash as integers.
+//
+// How to use:
+//
+//  uint32_t id = description_pool().intern("refried spicy beans");
+//  const std::string & text = description_pool().get(id);
+//  // same text, same ID
+//  assert(description_pool().intern(text) == id);
+//  // one release() per intern()
+//  description_pool().release(id);
+//  description_pool().release(id);
+//
+// Each string is reference counted, and removed when its last reference is
+// released. IDs are never reused, so an ID kept past that still can't name
+// another string; the same string interned again gets a new ID, though, so
+// IDs only compare equal to IDs taken while the string was alive. Removing
+// a string frees its text, and only its small fixed-size slot stays behind.
+// FoodItem holds one reference to its description, so a catalog that is
+// reloaded again and again only keeps the descriptions of items still in
+// use.
+// Strings live in segments that don't move once allocated, so get() is
+// lock-free and its references stay valid while the string is referenced.
+// Only intern() and the last release() of a string take a lock.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Finalizer from splitmix64; spreads every input bit over the output.
+uint64_t mix_hash64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// A 128-bit hash of a string's bytes, the same in every process.
+struct StringHash {
+  uint64_t low, high;
+
+  bool operator==(const StringHash & other) const {
+    return low == other.low && high == other.high;
+  }
+};
+
+StringHash hash_string(std::string_view value) {
+  uint64_t low = 0x9e3779b97f4a7c15ULL ^ value.size(), high = 0xc2b2ae3d27d4eb4fULL + value.size();
+  for (size_t i = 0; i < value.size(); i += 8) {
+    uint64_t word = 0;
+    std::memcpy(&word, value.data() + i, std::min<size_t>(8, value.size() - i));
+    low = mix_hash64(low ^ word) * 0xff51afd7ed558ccdULL;
+    high = mix_hash64(high + word) * 0xc4ceb9fe1a85ec53ULL;
+  }
+  return StringHash{mix_hash64(low), mix_hash64(high)};
+}
+
+class StringPool {
+public:
+  StringPool()
+  : _slots(0), _size(0), _bytes(0) {
+    for (auto & segment: _segments) {
+      segment.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  StringPool(const StringPool &) = delete;
+  StringPool & operator=(const StringPool &) = delete;
+
+  ~StringPool() {
+    for (auto & segment: _segments) {
+      delete[] segment.load();
+    }
+  }
+
+  // The ID of value, adding it to the pool if it isn't there yet. Takes a
+  // reference to the string, which release() gives back.
+  uint32_t intern(std::string_view value) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto found = _ids.find(value);
+    if (found != _ids.end()) {
+      entry(found->second).references.fetch_add(1, std::memory_order_relaxed);
+      return found->second;
+    }
+
+    // Always a new slot, so that no ID ever names two strings.
+    uint32_t id = _slots.load(std::memory_order_relaxed);
+    if (id == UINT32_MAX) {
+      throw std::length_error("string pool is out of IDs");
+    }
+    size_t segment, offset;
+    locate(id, segment, offset);
+    Entry * entries = _segments[segment].load(std::memory_order_relaxed);
+    if (!entries) {
+      entries = new Entry[segment_size(segment)];
+      _segments[segment].store(entries, std::memory_order_release);
+    }
+    Entry * slot = &entries[offset];
+    slot->value.assign(value);
+    slot->hash = hash_string(value);
+    slot->references.store(1, std::memory_order_relaxed);
+    slot->live = true;
+    _ids.emplace(slot->value, id);
+    _bytes += value.size();
+    _size.fetch_add(1, std::memory_order_relaxed);
+    _slots.store(id + 1, std::memory_order_release);
+    return id;
+  }
+
+  // Take another reference to a string the caller holds one to.
+  void retain(uint32_t id) {
+    entry(id).references.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Give back a reference taken by intern() or retain(). The last one
+  // removes the string.
+  void release(uint32_t id) {
+    Entry & released = entry(id);
+    if (released.references.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    // Interned again, or removed by another release that also saw the
+    // count reach zero, while the lock was free.
+    if (!released.live || released.references.load(std::memory_order_relaxed) != 0) {
+      return;
+    }
+    _ids.erase(std::string_view(released.value));
+    _bytes -= released.value.size();
+    released.value = std::string();
+    released.live = false;
+    _size.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // The string with this ID, which intern() must have returned and which
+  // must still be referenced.
+  const std::string & get(uint32_t id) const {
+    return entry(id).value;
+  }
+
+  // hash_string() of the string with this ID, computed once by intern().
+  const StringHash & hash(uint32_t id) const {
+    return entry(id).hash;
+  }
+
+  // Number of distinct strings.
+  size_t size() const {
+    return _size.load(std::memory_order_relaxed);
+  }
+
+  // Total length of the distinct strings.
+  size_t bytes() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _bytes;
+  }
+
+private:
+  struct Entry {
+    std::string value;
+    StringHash hash;
+    std::atomic<uint32_t> references{0};
+    // Whether the slot holds a string; only used under _mutex.
+    bool live = false;
+  };
+
+  // Segment s holds 1024 << s entries, so 22 segments cover every 32-bit ID.
+  static const size_t FIRST_SEGMENT_BITS = 10, SEGMENTS = 22;
+
+  static size_t segment_size(size_t segment) {
+    return size_t(1) << (FIRST_SEGMENT_BITS + segment);
+  }
+
+  static void locate(uint32_t id, size_t & segment, size_t & offset) {
+    uint64_t biased = uint64_t(id) + (uint64_t(1) << FIRST_SEGMENT_BITS);
+    segment = 63 - __builtin_clzll(biased) - FIRST_SEGMENT_BITS;
+    offset = biased - segment_size(segment);
+  }
+
+  Entry & entry(uint32_t id) const {
+    size_t segment, offset;
+    locate(id, segment, offset);
+    Entry * entries = _segments[segment].load(std::memory_order_acquire);
+    assert(entries && id < _slots.load(std::memory_order_acquire));
+    return entries[offset];
+  }
+
+  std::atomic<Entry *> _segments[SEGMENTS];
+  // Slots handed out so far, and the strings in them now.
+  std::atomic<uint32_t> _slots;
+  std::atomic<size_t> _size;
+  mutable std::mutex _mutex;
+  // Views into the stored strings.
+  std::unordered_map<std::string_view, uint32_t> _ids;
+  size_t _bytes;
+};
+
+// The pool of food descriptions, shared by every FoodItem in the process.
+// It is never destroyed, so descriptions stay valid during shutdown.
+StringPool & description_pool() {
+  static StringPool * pool = new StringPool;
+  return *pool;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// stringpool.hh
+///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,462 @@
+///////////////////////////////////////////////////////////////////////////////
+// threadpool.hh
+//
+// Work-stealing thread pool shared by all the parallel solver paths, so
+// that they don't each start their own threads and oversubscribe the
+// machine.
+//
+// How to use:
+//
+//  // fork/join
+//  TaskGroup group(default_thread_pool());
+//  group.run([&]() { left_half(); });
+//  group.run([&]() { right_half(); });
+//  group.wait();
+//
+//  // parallel loop over [0, n) in chunks of at least 1024 indices
+//  parallel_for(default_thread_pool(), 0, n, 1024,
+//    [&](size_t begin, size_t end) { ... });
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(MAXWEIGHT_USE_LIBNUMA)
+#include <numa.h>
+#endif
+
+class ThreadPool {
+public:
+  // Start thread_count worker threads; 0 means one per hardware thread.
+  // When cpus is non-empty, worker i is pinned to cpus[i % cpus.size()].
+  explicit ThreadPool(unsigned thread_count = 0, const std::vector<int> & cpus = {})
+  : _stopping(false), _pushes(0), _pending(0), _next_queue(0) {
+    if (thread_count == 0) {
+      thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 0; i < thread_count; i++) {
+      _queues.emplace_back(new WorkerQueue);
+    }
+    for (unsigned i = 0; i < thread_count; i++) {
+      _threads.emplace_back([this, i]() { worker_loop(i); });
+      if (!cpus.empty()) {
+        pin_thread(_threads.back(), cpus[i % cpus.size()]);
+      }
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool & operator=(const ThreadPool &) = delete;
+
+  // Finish all queued tasks, then stop the workers.
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(_sleep_mutex);
+      _stopping = true;
+    }
+    _wake.notify_all();
+    for (auto & thread: _threads) {
+      thread.join();
+    }
+  }
+
+  // Number of worker threads.
+  unsigned size() const {
+    return _threads.size();
+  }
+
+  // Index of the calling worker thread in this pool, or -1 when called from
+  // a thread that doesn't belong to this pool.
+  int current_worker() const {
+    return current_pool() == this ? current_index() : -1;
+  }
+
+  // Queue a task. From a worker thread the task goes on that worker's own
+  // deque; from any other thread the deques are filled round-robin. Idle
+  // workers steal from the other end of busy workers' deques.
+  void submit(std::function<void()> task) {
+    int self = current_worker();
+    size_t queue = self >= 0 ? self : _next_queue.fetch_add(1) % _queues.size();
+    push(queue, std::move(task), true);
+  }
+
+  // Queue a task that only worker may run; it is never stolen. Used when a
+  // task must touch memory local to that worker's CPU. With stealable, the
+  // task only starts on worker's deque, for locality, and idle workers may
+  // still take it.
+  void submit_to(unsigned worker, std::function<void()> task, bool stealable = false) {
+    assert(worker < _queues.size());
+    push(worker, std::move(task), stealable);
+  }
+
+  // Run one queued task on the calling thread, if any can be found.
+  // Returns whether a task was run. Threads waiting on a TaskGroup call this
+  // so that they help instead of blocking.
+  bool run_one() {
+    std::function<void()> task;
+    if (!try_pop(current_worker(), task)) {
+      return false;
+    }
+    if (_pending == 0) {
+      // Workers waiting to stop sleep until nothing is left queued.
+      std::lock_guard<std::mutex> lock(_sleep_mutex);
+      if (_stopping) {
+        _wake.notify_all();
+      }
+    }
+    task();
+    return true;
+  }
+
+  // Number of tasks queued so far, for wait_for_work().
+  size_t pushes() {
+    std::lock_guard<std::mutex> lock(_sleep_mutex);
+    return _pushes;
+  }
+
+  // Sleep until done() holds, or a task was queued since pushes() returned
+  // seen. done() is called under the pool's lock; whoever makes it true
+  // must then call notify_waiters(). Threads waiting on a TaskGroup use
+  // this between run_one() calls, so they neither spin nor miss work they
+  // could help with.
+  template <typename Done>
+  void wait_for_work(size_t seen, Done done) {
+    std::unique_lock<std::mutex> lock(_sleep_mutex);
+    _waiters++;
+    _waiting.wait(lock, [&]() {
+      return done() || _pushes != seen;
+    });
+    _waiters--;
+  }
+
+  void notify_waiters() {
+    std::lock_guard<std::mutex> lock(_sleep_mutex);
+    _waiting.notify_all();
+  }
+
+private:
+  struct Task {
+    std::function<void()> run;
+    bool stealable;
+  };
+
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  static const ThreadPool *& current_pool() {
+    static thread_local const ThreadPool * pool = nullptr;
+    return pool;
+  }
+
+  static int & current_index() {
+    static thread_local int index = -1;
+    return index;
+  }
+
+  static void pin_thread(std::thread & thread, int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+    (void) thread;
+    (void) cpu;
+#endif
+  }
+
+  void push(size_t queue, std::function<void()> task, bool stealable) {
+    {
+      std::lock_guard<std::mutex> lock(_queues[queue]->mutex);
+      _queues[queue]->tasks.push_back(Task{std::move(task), stealable});
+    }
+    bool waiters;
+    {
+      std::lock_guard<std::mutex> lock(_sleep_mutex);
+      _pending++;
+      _pushes++;
+      waiters = _waiters > 0;
+    }
+    if (waiters) {
+      _waiting.notify_all();
+    }
+    if (stealable) {
+      _wake.notify_one();
+    } else {
+      // Only one worker may take it, so make sure that one wakes up.
+      _wake.notify_all();
+    }
+  }
+
+  // Pop from our own deque (newest first), then steal from the others
+  // (oldest first). self is -1 for threads outside the pool, which only
+  // steal.
+  bool try_pop(int self, std::function<void()> & task) {
+    if (self >= 0) {
+      WorkerQueue & own = *_queues[self];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back().run);
+        own.tasks.pop_back();
+        _pending--;
+        return true;
+      }
+    }
+    size_t start = self >= 0 ? self + 1 : 0;
+    for (size_t i = 0; i < _queues.size(); i++) {
+      size_t victim = (start + i) % _queues.size();
+      if (static_cast<int>(victim) == self) {
+        continue;
+      }
+      WorkerQueue & other = *_queues[victim];
+      std::lock_guard<std::mutex> lock(other.mutex);
+      for (auto it = other.tasks.begin(); it != other.tasks.end(); ++it) {
+        if (it->stealable) {
+          task = std::move(it->run);
+          other.tasks.erase(it);
+          _pending--;
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  void worker_loop(int index) {
+    current_pool() = this;
+    current_index() = index;
+    for (;;) {
+      if (run_one()) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(_sleep_mutex);
+      if (_stopping && _pending == 0) {
+        return;
+      }
+      // Tasks pinned to other workers keep _pending non-zero, so sleep until
+      // something new is pushed, or when stopping until nothing is left.
+      size_t seen = _pushes;
+      lock.unlock();
+      if (run_one()) {
+        continue;
+      }
+      lock.lock();
+      _wake.wait(lock, [this, seen]() {
+        return (_stopping && _pending == 0) || _pushes != seen;
+      });
+    }
+  }
+
+  std::vector<std::unique_ptr<WorkerQueue>> _queues;
+  std::vector<std::thread> _threads;
+  std::mutex _sleep_mutex;
+  std::condition_variable _wake;
+  // Where threads outside the worker loop sleep in wait_for_work().
+  std::condition_variable _waiting;
+  size_t _waiters = 0;
+  bool _stopping;
+  size_t _pushes;
+  std::atomic<size_t> _pending;
+  std::atomic<size_t> _next_queue;
+};
+
+// Fork/join helper: run() forks tasks onto a pool, and wait() joins them,
+// running queued tasks on the waiting thread in the meantime, and sleeping
+// while there are none. If a task throws, the first exception is rethrown
+// from wait().
+class TaskGroup {
+public:
+  explicit TaskGroup(ThreadPool & pool)
+  : _pool(pool), _outstanding(0) { }
+
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup & operator=(const TaskGroup &) = delete;
+
+  ~TaskGroup() {
+    wait_quietly();
+  }
+
+  void run(std::function<void()> task) {
+    _outstanding++;
+    _pool.submit(wrap(std::move(task)));
+  }
+
+  // Like run(), but the task only runs on the given worker of the pool
+  // (see ThreadPool::submit_to for stealable).
+  void run_on(unsigned worker, std::function<void()> task, bool stealable = false) {
+    _outstanding++;
+    _pool.submit_to(worker, wrap(std::move(task)), stealable);
+  }
+
+  void wait() {
+    wait_quietly();
+    if (_error) {
+      std::exception_ptr error = _error;
+      _error = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+private:
+  std::function<void()> wrap(std::function<void()> task) {
+    return [this, task = std::move(task)]() {
+      try {
+        task();
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(_error_mutex);
+        if (!_error) {
+          _error = std::current_exception();
+        }
+      }
+      // The group may be gone as soon as the count reaches zero.
+      ThreadPool & pool = _pool;
+      if (--_outstanding == 0) {
+        pool.notify_waiters();
+      }
+    };
+  }
+
+  void wait_quietly() {
+    while (_outstanding > 0) {
+      size_t seen = _pool.pushes();
+      if (_pool.run_one()) {
+        continue;
+      }
+      _pool.wait_for_work(seen, [this]() { return _outstanding == 0; });
+    }
+  }
+
+  ThreadPool & _pool;
+  std::atomic<size_t> _outstanding;
+  std::mutex _error_mutex;
+  std::exception_ptr _error;
+};
+
+// Call body(chunk_begin, chunk_end) on disjoint chunks covering
+// [begin, end), in parallel on pool. Chunks hold at least grain indices,
+// and there are at most a few per worker.
+template <typename Body>
+void parallel_for(ThreadPool & pool, size_t begin, size_t end, size_t grain, Body body) {
+  if (begin >= end) {
+    return;
+  }
+  size_t count = end - begin;
+  size_t chunk = std::max<size_t>({grain, 1, (count + 4 * pool.size() - 1) / (4 * pool.size())});
+  if (chunk >= count) {
+    body(begin, end);
+    return;
+  }
+  TaskGroup group(pool);
+  for (size_t lo = begin; lo < end; lo += chunk) {
+    size_t hi = std::min(end, lo + chunk);
+    group.run([&body, lo, hi]() { body(lo, hi); });
+  }
+  group.wait();
+}
+
+// CPUs to pin thread_count workers to so that consecutive workers share a
+// NUMA node: node 0's CPUs first, then node 1's, and so on. Solvers that
+// split data by worker index then keep neighbouring parts on one node.
+// Only CPUs this process may run on are used. Uses libnuma when built with
+// MAXWEIGHT_USE_LIBNUMA, and otherwise takes the CPUs in numbering order.
+// Returns an empty list (no pinning) when the CPUs can't be determined.
+std::vector<int> numa_worker_cpus(unsigned thread_count = 0) {
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    return cpus;
+  }
+  auto allowed = [&set](int cpu) {
+    return cpu < CPU_SETSIZE && CPU_ISSET(cpu, &set);
+  };
+#else
+  auto allowed = [](int) {
+    return true;
+  };
+#endif
+#if defined(MAXWEIGHT_USE_LIBNUMA)
+  if (numa_available() >= 0) {
+    struct bitmask * node_cpus = numa_allocate_cpumask();
+    for (int node = 0; node <= numa_max_node(); node++) {
+      if (numa_node_to_cpus(node, node_cpus) != 0) {
+        continue;
+      }
+      for (unsigned cpu = 0; cpu < node_cpus->size; cpu++) {
+        if (numa_bitmask_isbitset(node_cpus, cpu) && allowed(cpu)) {
+          cpus.push_back(cpu);
+        }
+      }
+    }
+    numa_free_cpumask(node_cpus);
+  }
+#endif
+#ifdef __linux__
+  if (cpus.empty()) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (allowed(cpu)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+#endif
+  if (thread_count != 0 && cpus.size() > thread_count) {
+    // Spread the workers evenly over the list instead of filling the first
+    // node only.
+    std::vector<int> spread;
+    for (unsigned i = 0; i < thread_count; i++) {
+      spread.push_back(cpus[i * cpus.size() / thread_count]);
+    }
+    cpus = spread;
+  }
+  return cpus;
+}
+
+// Settings for default_thread_pool(). They only take effect if set before
+// the default pool is first used.
+struct ThreadPoolSettings {
+  // Number of worker threads; 0 means one per hardware thread.
+  unsigned thread_count = 0;
+  // CPUs to pin workers to; empty means no pinning. numa_worker_cpus()
+  // gives a NUMA-friendly placement.
+  std::vector<int> cpus;
+};
+
+ThreadPoolSettings & default_thread_pool_settings() {
+  static ThreadPoolSettings settings;
+  return settings;
+}
+
+// The project-wide pool used by the parallel solvers unless they are given
+// a different one.
+ThreadPool & default_thread_pool() {
+  static ThreadPool pool(
+    default_thread_pool_settings().thread_count,
+    default_thread_pool_settings().cpus
+  );
+  return pool;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// threadpool.hh
+///////////////////////////////////////////////////////////////////////////////